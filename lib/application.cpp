@@ -15,6 +15,8 @@
 #include "audio.h"
 #include "../src/settings_menu.h"
 #include "../src/main.h"
+#include "shader_cache.h"
+#include "renderer_calibration.h"
 
 #include <algorithm>
 #include <iostream>
@@ -959,6 +961,8 @@ App *app_new() {
         delete app;
         return nullptr;
     }
+    if (auto renderer = (const char *) glGetString(GL_RENDERER))
+        app->gl_renderer = renderer;
     
     poll_descriptor(app, xcb_get_file_descriptor(app->connection), POLLIN, xcb_poll_wakeup, nullptr, "XCB");
     
@@ -985,9 +989,10 @@ App *app_new() {
     // free stuff
     xcb_free_colormap(connection, colormap);
     xcb_destroy_window(connection, window);
-    glXDestroyContext(display, app->version_check_context);
-    app->version_check_context = nullptr;
     glXMakeContextCurrent(display, None, None, nullptr);
+    // Instead of destroying it, the version check context is kept alive as the root of the share group
+    app->share_context = app->version_check_context;
+    app->version_check_context = nullptr;
     
     return app;
 }
@@ -1352,7 +1357,7 @@ client_new(App *app, Settings settings, const std::string &name) {
     //client->context = glXCreateNewContext(client->app->display, client->app->chosen_config, GLX_RGBA_TYPE, 0, True);
     client->context = glXCreateContextAttribsARB(client->app->display,
                                app->chosen_config,
-                               0,        // no sharing
+                               app->share_context, // share programs with every other client
                                True,     // direct
                                context_attribs
     );
@@ -1369,7 +1374,7 @@ client_new(App *app, Settings settings, const std::string &name) {
     if (!client->ctx) {
         client->ctx = new DrawContext;
         client->ctx->buffer = new OffscreenFrameBuffer(client->bounds->w, client->bounds->h);
-        client->should_use_gl = winbar_settings->use_opengl;
+        client->should_use_gl = renderer_should_use_gl(name);
     }
     
     // vsync off
@@ -1404,6 +1409,11 @@ void destroy_client(App *app, AppClient *client) {
     delete client->bounds;
     if (client->auto_delete_root)
         delete client->root;
+    if (client->back_cr) {
+        remove_cached_fonts(client->back_cr);
+        cairo_destroy(client->back_cr);
+        cairo_surface_destroy(client->back_buffer);
+    }
     cairo_destroy(client->cr);
     xcb_free_colormap(app->connection, client->colormap);
     xcb_cursor_context_free(client->cursor_ctx);
@@ -1661,9 +1671,11 @@ void client_close(App *app, AppClient *client) {
     
     destroy_client(app, client);
     
-    app->running = false;
-    for (auto c: app->clients)
-        app->running = c->keeps_app_running;
+    if (client->keeps_app_running) {
+        app->running = false;
+        for (auto c: app->clients)
+            app->running = c->keeps_app_running;
+    }
     
     if (w != 0) {
         xcb_set_input_focus(app->connection, XCB_INPUT_FOCUS_PARENT, w,
@@ -1801,7 +1813,51 @@ void client_paint_gl(App *app, AppClient *client, bool force_repaint) {
     }
 }
 
-// TODO: double buffering not really working
+// Makes sure the back buffer is at least as big as the client (or a single pixel for clients painting with OpenGL,
+// which never present it and only need somewhere for stray cairo calls to go)
+static void ensure_back_buffer(AppClient *client) {
+    bool gl = client->gl_window_created && client->should_use_gl;
+    int w = gl ? 1 : std::max(1, (int) client->bounds->w);
+    int h = gl ? 1 : std::max(1, (int) client->bounds->h);
+    if (client->back_buffer) {
+        if (gl ? client->back_buffer_w == 1 && client->back_buffer_h == 1 :
+            w <= client->back_buffer_w && h <= client->back_buffer_h)
+            return;
+    }
+    
+    if (client->back_cr) {
+        remove_cached_fonts(client->back_cr);
+        cairo_destroy(client->back_cr);
+        cairo_surface_destroy(client->back_buffer);
+    }
+    if (gl) {
+        client->back_buffer_w = 1;
+        client->back_buffer_h = 1;
+    } else {
+        // Grow a little more than needed so windows that slowly grow (animations) don't reallocate every configure
+        client->back_buffer_w = std::max(w, client->back_buffer_w + client->back_buffer_w / 4);
+        client->back_buffer_h = std::max(h, client->back_buffer_h + client->back_buffer_h / 4);
+    }
+    // Similar to an xcb surface means a pixmap on the server, so painting and presenting never leave the server
+    client->back_buffer = cairo_surface_create_similar(cairo_get_target(client->cr), CAIRO_CONTENT_COLOR_ALPHA,
+                                                       client->back_buffer_w, client->back_buffer_h);
+    client->back_cr = cairo_create(client->back_buffer);
+}
+
+// Copies the given area of the back buffer onto the window
+static void client_present(AppClient *client, double x, double y, double w, double h) {
+    if (!client->back_buffer)
+        return;
+    cairo_t *cr = client->cr;
+    cairo_save(cr);
+    cairo_rectangle(cr, x, y, w, h);
+    cairo_clip(cr);
+    cairo_set_source_surface(cr, client->back_buffer, 0, 0);
+    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+    cairo_paint(cr);
+    cairo_restore(cr);
+}
+
 void client_paint(App *app, AppClient *client, bool force_repaint) {
     //client_paint_gl(app, client, force_repaint);
 //    return;
@@ -1839,19 +1895,29 @@ void client_paint(App *app, AppClient *client, bool force_repaint) {
                 client->delta = current - client->last_repaint_time;
                 client->last_repaint_time = current;
 
+                // Everything is painted into the back buffer, and then copied to the window in one request.
+                // (Clients painting with OpenGL get a one pixel one so stray cairo calls don't reach the window.)
+                ensure_back_buffer(client);
+                cairo_t *window_cr = client->cr;
+                client->cr = client->back_cr;
+                
                 cairo_save(client->cr);
-                cairo_push_group(client->cr);
-
+                cairo_rectangle(client->cr, 0, 0, client->bounds->w, client->bounds->h);
+                cairo_set_operator(client->cr, CAIRO_OPERATOR_CLEAR);
+                cairo_fill(client->cr);
+                cairo_set_operator(client->cr, CAIRO_OPERATOR_OVER);
+                
                 paint_container(app, client, client->root);
                 
-                cairo_pop_group_to_source(client->cr);
-                cairo_set_operator(client->cr, CAIRO_OPERATOR_SOURCE);
+                cairo_restore(client->cr);
+                client->cr = window_cr;
+                
                 if (!client->should_use_gl) {
-                    cairo_paint(client->cr);
+                    client_present(client, 0, 0, client->bounds->w, client->bounds->h);
                 }
-                cairo_restore(client->cr);
                 
-                if (cairo_status(client->cr) != CAIRO_STATUS_SUCCESS) {
+                if (cairo_status(client->cr) != CAIRO_STATUS_SUCCESS ||
+                    cairo_status(client->back_cr) != CAIRO_STATUS_SUCCESS) {
                     restart = true;
                     app->running = false;
                     return;
@@ -2414,6 +2480,8 @@ void handle_configure_notify(App *app, AppClient *client, double x, double y, do
     client->bounds->y = y;
     
     cairo_xcb_surface_set_size(cairo_get_target(client->cr), client->bounds->w, client->bounds->h);
+    if (client->back_buffer)
+        ensure_back_buffer(client);
     
     client_layout(app, client);
 }
@@ -2572,6 +2640,13 @@ void handle_xcb_event(App *app, xcb_window_t window_number, xcb_generic_event_t
     bool forced = false;
     switch (event_type) {
         case XCB_EXPOSE: {
+            // The last frame is still in the back buffer, so exposed areas can be restored without repainting
+            auto *e = (xcb_expose_event_t *) event;
+            auto client = client_by_window(app, e->window);
+            if (valid_client(app, client) && !client->should_use_gl) {
+                client_present(client, e->x, e->y, e->width, e->height);
+                xcb_flush(app->connection);
+            }
             break;
         }
         case XCB_CONFIGURE_NOTIFY: {
@@ -2711,7 +2786,7 @@ void handle_xcb_event(App *app, xcb_window_t window_number, xcb_generic_event_t
         case XCB_UNMAP_NOTIFY: {
             if (auto client = client_by_window(app, window_number)) {
                 client->mapped = false;
-                if (winbar_settings->use_opengl && client->name != "taskbar") {
+                if (client->should_use_gl && client->name != "taskbar") {
                     client_unregister_animation(app, client);
                 }
             }
@@ -2751,7 +2826,7 @@ void handle_xcb_event(App *app, xcb_window_t window_number, xcb_generic_event_t
                     }
                 }
                 xcb_flush(app->connection);
-                if (winbar_settings->use_opengl && client->name != "taskbar") {
+                if (client->should_use_gl && client->name != "taskbar") {
                     client_register_animation(app, client);
                 }
             }
@@ -3027,6 +3102,13 @@ void app_clean(App *app) {
     cleanup_cached_fonts();
     cleanup_cached_atoms();
     
+    shader_cache_clear();
+    if (app->share_context) {
+        glXMakeContextCurrent(app->display, None, None, nullptr);
+        glXDestroyContext(app->display, app->share_context);
+        app->share_context = nullptr;
+    }
+    
     for (auto t: app->timeouts) {
         for (int i = 0; i < app->descriptors_being_polled.size(); i++) {
             if (app->descriptors_being_polled[i].file_descriptor == t->file_descriptor) {
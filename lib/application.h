@@ -196,6 +196,11 @@ struct App {
     
     GLXContext version_check_context;
     
+    // Every client context shares objects with this one so that GL programs only have to be compiled once
+    GLXContext share_context = nullptr;
+    // GL_RENDERER of share_context
+    std::string gl_renderer;
+    
     xcb_key_symbols_t *key_symbols = nullptr;
     
     xcb_visualtype_t *argb_visualtype = nullptr;
@@ -0,0 +1,118 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#include "average_color_cache.h"
+#include "icon_loader.h"
+
+#include <unordered_map>
+#include <fstream>
+#include <sstream>
+#include <cerrno>
+#include <sys/stat.h>
+
+#ifdef TRACY_ENABLE
+
+#include "../tracy/public/tracy/Tracy.hpp"
+
+#endif
+
+struct CachedAverageColor {
+    long mtime = 0;
+    int size = 0;
+    double r = 0;
+    double g = 0;
+    double b = 0;
+    double a = 0;
+};
+
+static std::unordered_map<std::string, CachedAverageColor> average_colors;
+static bool average_colors_loaded = false;
+
+static std::string cache_path(bool create_directories) {
+    const char *home_directory = getenv("HOME");
+    if (!home_directory)
+        return "";
+    std::string path(home_directory);
+    path += "/.cache";
+    if (create_directories && mkdir(path.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) == -1)
+        if (errno != EEXIST)
+            return "";
+    path += "/winbar";
+    if (create_directories && mkdir(path.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) == -1)
+        if (errno != EEXIST)
+            return "";
+    path += "/average_colors";
+    return path;
+}
+
+// Each line is: mtime size r g b a path (path is last since it can contain spaces)
+static void load_average_colors() {
+    average_colors_loaded = true;
+    std::ifstream file(cache_path(false));
+    if (!file.is_open())
+        return;
+    
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream stream(line);
+        CachedAverageColor cached;
+        stream >> cached.mtime >> cached.size >> cached.r >> cached.g >> cached.b >> cached.a;
+        if (!stream)
+            continue;
+        std::string path;
+        std::getline(stream >> std::ws, path);
+        if (!path.empty())
+            average_colors[path] = cached;
+    }
+}
+
+static void save_average_colors() {
+    std::string path = cache_path(true);
+    if (path.empty())
+        return;
+    std::ofstream file(path + ".tmp");
+    if (!file.is_open())
+        return;
+    for (const auto &[icon_path, cached]: average_colors)
+        file << cached.mtime << " " << cached.size << " " << cached.r << " " << cached.g << " " << cached.b << " "
+             << cached.a << " " << icon_path << std::endl;
+    file.close();
+    if (file)
+        rename((path + ".tmp").c_str(), path.c_str());
+}
+
+void get_average_color_cached(cairo_surface_t *surface, const std::string &path, ArgbColor *result) {
+#ifdef TRACY_ENABLE
+    ZoneScoped;
+#endif
+    struct stat info;
+    // A placeholder is still transparent, so its color must not be remembered for the path
+    if (path.empty() || surface == nullptr || icon_load_pending(surface) || stat(path.c_str(), &info) != 0) {
+        get_average_color(surface, result);
+        return;
+    }
+    if (!average_colors_loaded)
+        load_average_colors();
+    
+    int size = cairo_image_surface_get_width(surface);
+    auto found = average_colors.find(path);
+    if (found != average_colors.end() && found->second.mtime == info.st_mtime && found->second.size == size) {
+        result->r = found->second.r;
+        result->g = found->second.g;
+        result->b = found->second.b;
+        result->a = found->second.a;
+        return;
+    }
+    
+    get_average_color(surface, result);
+    CachedAverageColor cached;
+    cached.mtime = info.st_mtime;
+    cached.size = size;
+    cached.r = result->r;
+    cached.g = result->g;
+    cached.b = result->b;
+    cached.a = result->a;
+    average_colors[path] = cached;
+    save_average_colors();
+}
@@ -0,0 +1,17 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#ifndef WINBAR_AVERAGE_COLOR_CACHE_H
+#define WINBAR_AVERAGE_COLOR_CACHE_H
+
+#include "utility.h"
+
+#include <string>
+
+// Same as get_average_color, but the result is remembered (also on disk in ~/.cache/winbar/average_colors) for the
+// image file the surface was loaded from, so it's only computed again when that file is modified or the surface
+// has a different size. If path is empty (the surface didn't come from a file), nothing is cached.
+void get_average_color_cached(cairo_surface_t *surface, const std::string &path, ArgbColor *result);
+
+#endif //WINBAR_AVERAGE_COLOR_CACHE_H
@@ -3,6 +3,7 @@
 #include "application.h"
 #include "../src/components.h"
 #include "../src/config.h"
+#include "shader_cache.h"
 
 #include <cassert>
 #include <cmath>
@@ -1276,13 +1277,7 @@ void main()
     // ... (This part depends on your setup)
     
     // Compile shaders and create shader program
-    GLuint vertexShader = compileShader(vertexShaderSource, GL_VERTEX_SHADER);
-    GLuint fragmentShader = compileShader(fragmentShaderSource, GL_FRAGMENT_SHADER);
-    
-    shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glLinkProgram(shaderProgram);
+    shaderProgram = shader_cache_program(vertexShaderSource, fragmentShaderSource);
     
     // Get uniform location for projection matrix
     projectionUniform = glGetUniformLocation(shaderProgram, "projection");
@@ -1533,14 +1528,7 @@ void ShapeRenderer::set_color(glm::vec4 top_left_rgba, glm::vec4 top_right_rgba,
 //
 void ShapeRenderer::initialize() {
     // Compile shaders and create shader program.
-    GLuint vertexShader = compileShader(vertexShaderSource, GL_VERTEX_SHADER);
-    GLuint fragmentShader = compileShader(fragmentShaderSource, GL_FRAGMENT_SHADER);
-    
-    shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glLinkProgram(shaderProgram);
-    // (Error checking omitted for brevity)
+    shaderProgram = shader_cache_program(vertexShaderSource, fragmentShaderSource);
     
     // Get uniform locations.
     projectionUniform = glGetUniformLocation(shaderProgram, "projection");
@@ -1667,26 +1655,8 @@ void ImmediateTexture::create(unsigned char *pixels, int w, int h, bool keep_asp
                                      "    FragColor = texture(uTexture, TexCoord);\n"
                                      "}";
     
-    if (shaderProgram == 0) {
-        GLuint vertexShader = compileShader(vertexShaderCode, GL_VERTEX_SHADER);
-        GLuint fragmentShader = compileShader(fragmentShaderCode, GL_FRAGMENT_SHADER);
-        
-        shaderProgram = glCreateProgram();
-        glAttachShader(shaderProgram, vertexShader);
-        glAttachShader(shaderProgram, fragmentShader);
-        glLinkProgram(shaderProgram);
-        
-        GLint success;
-        glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
-        if (!success) {
-            char infoLog[512];
-            glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
-            fprintf(stderr, "Shader Program Linking Failed:\n%s\n", infoLog);
-        }
-        
-        glDeleteShader(vertexShader);
-        glDeleteShader(fragmentShader);
-    }
+    if (shaderProgram == 0)
+        shaderProgram = shader_cache_program(vertexShaderCode, fragmentShaderCode);
     
     glGenTextures(1, &textureID);
     glBindTexture(GL_TEXTURE_2D, textureID);
@@ -1800,7 +1770,6 @@ ImmediateTexture::ImmediateTexture(InitialIcon *initial_icon) {
 
 
 FreeFont::~FreeFont() {
-    glDeleteProgram(shader_program);
     glDeleteBuffers(1, &VBO);
     glDeleteTextures(1, &texture_id);
     glDeleteVertexArrays(1, &VAO);
@@ -1948,25 +1917,8 @@ FreeFont::FreeFont(int size, std::string font_name, bool bold, bool italic) {
       fragColor = vec4(srcColor.rgb * srcColor.a, srcColor.a);
     }
 )";
-    // Compile shaders
-    GLuint vertexShader = compileShader(vertexShaderCode, GL_VERTEX_SHADER);
-    GLuint fragmentShader = compileShader(fragmentShaderCode, GL_FRAGMENT_SHADER);
-    
-    // Link shaders
-    shader_program = glCreateProgram();
-    glAttachShader(shader_program, vertexShader);
-    glAttachShader(shader_program, fragmentShader);
-    glLinkProgram(shader_program);
-    GLint success;
-    glGetProgramiv(shader_program, GL_LINK_STATUS, &success);
-    if (!success) {
-        char infoLog[512];
-        glGetProgramInfoLog(shader_program, 512, NULL, infoLog);
-        fprintf(stderr, "Shader Program Linking Failed:\n%s\n", infoLog);
-    }
-    
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
+    // Compile and link shaders (only the first font ever created actually compiles)
+    shader_program = shader_cache_program(vertexShaderCode, fragmentShaderCode);
     
     glUseProgram(shader_program);
     // Get uniform location
@@ -2695,6 +2647,7 @@ OffscreenFrameBuffer::~OffscreenFrameBuffer() {
 }
 
 void OffscreenFrameBuffer::push() {
+    blur_valid = false;
     glBindFramebuffer(GL_FRAMEBUFFER, fbo);
     glViewport(0, 0, width, height); // Ensure the viewport matches the FBO size
     glClearColor(0.0f, 0.0f, 0.0f, 0.0f); // Set clear color to transparent black (or any color you need)
@@ -2704,26 +2657,114 @@ void OffscreenFrameBuffer::push() {
     //glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 }
 
+void OffscreenFrameBuffer::blur_pass(GLuint program, GLuint source, const BlurLevel &target) {
+    glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+    glViewport(0, 0, target.w, target.h);
+    glUseProgram(program);
+    glUniform2f(glGetUniformLocation(program, "halfpixel"), 0.5f / target.w, 0.5f / target.h);
+    glUniform1f(glGetUniformLocation(program, "offset"), blur_radius);
+    glBindTexture(GL_TEXTURE_2D, source);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+}
+
 void OffscreenFrameBuffer::pop(bool blur) {
-    glBindFramebuffer(GL_FRAMEBUFFER, 0); // Bind back to the default framebuffer
+    GLuint result = texColorBuffer;
     if (blur) {
-        glUseProgram(shaderProgramBlur);
-    } else {
-        glUseProgram(shaderProgram);
+        if (blur_levels.empty())
+            create_blur_levels();
+        if (!blur_valid && !blur_levels.empty()) {
+            // Passes overwrite their targets completely, so blending and clipping have to be off
+            GLboolean scissor = glIsEnabled(GL_SCISSOR_TEST);
+            glDisable(GL_BLEND);
+            glDisable(GL_SCISSOR_TEST);
+            glBindVertexArray(quadVAO);
+            
+            // Halve the image blur_levels.size() times, then walk back up to half resolution
+            GLuint source = texColorBuffer;
+            for (const auto &level: blur_levels) {
+                blur_pass(shaderProgramDown, source, level);
+                source = level.texture;
+            }
+            for (int i = (int) blur_levels.size() - 2; i >= 0; i--)
+                blur_pass(shaderProgramUp, blur_levels[i + 1].texture, blur_levels[i]);
+            
+            if (scissor)
+                glEnable(GL_SCISSOR_TEST);
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+            blur_valid = true;
+        }
+        // Upscaling the half resolution result is left to the linear filter of the final draw
+        if (!blur_levels.empty())
+            result = blur_levels[0].texture;
     }
+    
+    glBindFramebuffer(GL_FRAMEBUFFER, 0); // Bind back to the default framebuffer
+    glViewport(0, 0, width, height);
+    glUseProgram(shaderProgram);
     glBindVertexArray(quadVAO);
-    glBindTexture(GL_TEXTURE_2D, texColorBuffer);
+    glBindTexture(GL_TEXTURE_2D, result);
     glDrawArrays(GL_TRIANGLES, 0, 6);
     glBindTexture(GL_TEXTURE_2D, 0);
     glBindVertexArray(0);
     glUseProgram(0);
 }
 
+void OffscreenFrameBuffer::set_blur(int passes, float radius) {
+    if (passes == blur_passes && radius == blur_radius)
+        return;
+    blur_passes = passes;
+    blur_radius = radius;
+    destroy_blur_levels();
+}
+
+void OffscreenFrameBuffer::create_blur_levels() {
+    int w = width;
+    int h = height;
+    for (int i = 0; i < blur_passes; i++) {
+        w /= 2;
+        h /= 2;
+        if (w < 1 || h < 1)
+            break;
+        BlurLevel level;
+        level.w = w;
+        level.h = h;
+        
+        glGenTextures(1, &level.texture);
+        glBindTexture(GL_TEXTURE_2D, level.texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        
+        glGenFramebuffers(1, &level.fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, level.fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, level.texture, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::FRAMEBUFFER:: Blur framebuffer is not complete!" << std::endl;
+        
+        blur_levels.push_back(level);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    blur_valid = false;
+}
+
+void OffscreenFrameBuffer::destroy_blur_levels() {
+    for (auto &level: blur_levels) {
+        glDeleteFramebuffers(1, &level.fbo);
+        glDeleteTextures(1, &level.texture);
+    }
+    blur_levels.clear();
+    blur_valid = false;
+}
+
 void OffscreenFrameBuffer::destroy() {
+    destroy_blur_levels();
     glDeleteFramebuffers(1, &fbo);
     glDeleteTextures(1, &texColorBuffer);
     glDeleteRenderbuffers(1, &rbo);
-    glDeleteProgram(shaderProgram);
     glDeleteVertexArrays(1, &quadVAO);
     glDeleteBuffers(1, &quadVBO);
 }
@@ -2741,6 +2782,9 @@ void OffscreenFrameBuffer::create(int w, int h) {
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // So the blur taps along the border don't wrap around to the other side
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glBindTexture(GL_TEXTURE_2D, 0);
     
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texColorBuffer, 0);
@@ -2751,24 +2795,10 @@ void OffscreenFrameBuffer::create(int w, int h) {
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     
     
-    // Load and compile shaders and link program
-    GLuint vertexShader = compileShader(vertexShaderSource, GL_VERTEX_SHADER);
-    GLuint fragmentShader = compileShader(fragmentShaderSource, GL_FRAGMENT_SHADER);
-    GLuint fragmentShaderBlur = compileShader(fragmentShaderSourceBlur, GL_FRAGMENT_SHADER);
-    shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glLinkProgram(shaderProgram);
-    
-    shaderProgramBlur = glCreateProgram();
-    glAttachShader(shaderProgramBlur, vertexShader);
-    glAttachShader(shaderProgramBlur, fragmentShaderBlur);
-    glLinkProgram(shaderProgramBlur);
-    
-    // Cleanup shaders (they can be deleted once linked into a program)
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
-    glDeleteShader(fragmentShaderBlur);
+    // Load and compile shaders and link program (resizing reuses the cached programs)
+    shaderProgram = shader_cache_program(vertexShaderSource, fragmentShaderSource);
+    shaderProgramDown = shader_cache_program(vertexShaderSource, fragmentShaderSourceDown);
+    shaderProgramUp = shader_cache_program(vertexShaderSource, fragmentShaderSourceUp);
     
     // Setup quad for drawing FBO texture
     float quadVertices[] = {
@@ -382,7 +382,7 @@ public:
     
     float width = 0;
     float height = 0;
-    unsigned int textureID;
+    unsigned int textureID = 0;
     GLuint vao = 0;
     GLuint vbo = 0;
     GLuint shaderProgram = 0; // Shared among all ImmediateTexture instances
@@ -503,21 +503,42 @@ public:
     GLuint texColorBuffer;
     GLuint rbo;
     GLuint shaderProgram;
-    GLuint shaderProgramBlur;
+    GLuint shaderProgramDown;
+    GLuint shaderProgramUp;
     GLuint quadVAO, quadVBO;
     int width, height;
     
+    // How many times the image is halved before being scaled back up (more passes = wider blur, cheaper per pixel)
+    int blur_passes = 3;
+    // Distance (in texels of the level being sampled) of the Kawase taps
+    float blur_radius = 2.0f;
+    
     OffscreenFrameBuffer(int width, int height);
     
     ~OffscreenFrameBuffer();
     
     void push();
     
+    // If blur is true and nothing was pushed since the last blurred pop, the previous blur result is reused
     void pop(bool blur = false);
     
     void resize(int w, int h);
+    
+    void set_blur(int passes, float radius);
 
 private:
+    // Reduced resolution levels used by the dual Kawase blur. Level i is (width >> (i + 1), height >> (i + 1)).
+    struct BlurLevel {
+        GLuint fbo = 0;
+        GLuint texture = 0;
+        int w = 0;
+        int h = 0;
+    };
+    std::vector<BlurLevel> blur_levels;
+    
+    // False whenever the contents of texColorBuffer changed since blur_levels were generated
+    bool blur_valid = false;
+    
     // Placeholder for actual shader source code
     const char *vertexShaderSource = R"glsl(
         #version 330 core
@@ -545,39 +566,46 @@ private:
         }
     )glsl";
     
-    const char *fragmentShaderSourceBlur = R"glsl(
+    // Dual Kawase downsample: centre tap plus four diagonal taps (which land between texels, so each is a free 2x2 box)
+    const char *fragmentShaderSourceDown = R"glsl(
         #version 330 core
         out vec4 FragColor;
 
         in vec2 TexCoords;
         uniform sampler2D screenTexture;
+        uniform vec2 halfpixel;
+        uniform float offset;
 
-        const float FROST_INTENSITY = 0.1;
-        
-        vec3 tex(vec2 uv) {
-            return pow(texture(screenTexture, uv).rgb, vec3(2.2));
-        }
-        
-        vec2 hash22(vec2 uv) {
-            vec3 p3 = fract(vec3(uv.xyx) * vec3(.1031, .1030, .0973));
-            p3 += dot(p3, p3.yzx + 33.33);
-            return fract((p3.xx + p3.yz) * p3.zy);
+        void main() {
+            vec4 sum = texture(screenTexture, TexCoords) * 4.0;
+            sum += texture(screenTexture, TexCoords - halfpixel * offset);
+            sum += texture(screenTexture, TexCoords + halfpixel * offset);
+            sum += texture(screenTexture, TexCoords + vec2(halfpixel.x, -halfpixel.y) * offset);
+            sum += texture(screenTexture, TexCoords - vec2(halfpixel.x, -halfpixel.y) * offset);
+            FragColor = sum / 8.0;
         }
+    )glsl";
+    
+    // Dual Kawase upsample: eight taps in a diamond around the destination texel
+    const char *fragmentShaderSourceUp = R"glsl(
+        #version 330 core
+        out vec4 FragColor;
+
+        in vec2 TexCoords;
+        uniform sampler2D screenTexture;
+        uniform vec2 halfpixel;
+        uniform float offset;
 
         void main() {
-            vec2 st = TexCoords;
-            vec2 uv = vec2(TexCoords.x / 5, TexCoords.y / 5);
-            float t = 0.0;
-            
-            float d = length(uv);
-            
-            vec2 noise = (hash22(st * 1000.) * 2. - 1.) * FROST_INTENSITY;
-            vec2 tex_offset = vec2(t / 4., sin(t / 8.));
-            vec3 color = tex(st + noise + tex_offset);
-            
-            vec3 srgb = pow(color, vec3(1. / 2.2));
-            vec4 srcColor = mix(vec4(srgb, 1.0), texture(screenTexture, uv), 0.87);
-            FragColor = vec4(srcColor.rgb * srcColor.a, srcColor.a);
+            vec4 sum = texture(screenTexture, TexCoords + vec2(-halfpixel.x * 2.0, 0.0) * offset);
+            sum += texture(screenTexture, TexCoords + vec2(-halfpixel.x, halfpixel.y) * offset) * 2.0;
+            sum += texture(screenTexture, TexCoords + vec2(0.0, halfpixel.y * 2.0) * offset);
+            sum += texture(screenTexture, TexCoords + vec2(halfpixel.x, halfpixel.y) * offset) * 2.0;
+            sum += texture(screenTexture, TexCoords + vec2(halfpixel.x * 2.0, 0.0) * offset);
+            sum += texture(screenTexture, TexCoords + vec2(halfpixel.x, -halfpixel.y) * offset) * 2.0;
+            sum += texture(screenTexture, TexCoords + vec2(0.0, -halfpixel.y * 2.0) * offset);
+            sum += texture(screenTexture, TexCoords + vec2(-halfpixel.x, -halfpixel.y) * offset) * 2.0;
+            FragColor = sum / 12.0;
         }
     )glsl";
 //
@@ -610,6 +638,12 @@ private:
     void destroy();
     
     void create(int w, int h);
+    
+    void create_blur_levels();
+    
+    void destroy_blur_levels();
+    
+    void blur_pass(GLuint program, GLuint source, const BlurLevel &target);
 };
 
 #include <atomic>
@@ -751,6 +785,13 @@ struct AppClient {
     
     bool window_supports_transparency;
     cairo_t *cr = nullptr;
+    
+    // Persistent server side buffer that client_paint paints into and then copies to the window.
+    // Only ever grows (on configure) so resize animations don't reallocate it every frame.
+    cairo_surface_t *back_buffer = nullptr;
+    cairo_t *back_cr = nullptr;
+    int back_buffer_w = 0;
+    int back_buffer_h = 0;
     xcb_colormap_t colormap;
     xcb_cursor_context_t *cursor_ctx;
     xcb_cursor_t cursor = -1;
@@ -0,0 +1,562 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#include "desktop_entry_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <unordered_map>
+#include <string_view>
+#include <cstring>
+#include <cerrno>
+#include <cctype>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef TRACY_ENABLE
+
+#include "../tracy/public/tracy/Tracy.hpp"
+
+#endif
+
+// Bump if the layout of the file or the fields read from .desktop files change.
+static uint32_t desktop_cache_version = 2;
+
+static const char *desktop_field_keys[DesktopFieldCount] = {
+        "Name",
+        "StartupWMClass",
+        "Exec",
+        "Keywords",
+        "Categories",
+        "GenericName",
+        "Icon",
+        "NoDisplay",
+        "NotShowIn",
+        "OnlyShowIn",
+};
+
+// Layout of ~/.cache/winbar/desktop_entries (every section starts 8 byte aligned):
+//
+//   DesktopCacheHeader
+//   DesktopCacheRoot[root_count]               a directory passed to desktop_entries_load
+//   DesktopCacheDirectory[directory_count]     every folder found under a root (and the root itself)
+//   DesktopCacheEntry[entry_count]             every .desktop file found under a root
+//   char strings[strings_size]
+struct DesktopCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t root_count;
+    uint32_t directory_count;
+    uint32_t entry_count;
+    uint64_t file_size;
+    uint64_t roots_offset;
+    uint64_t directories_offset;
+    uint64_t entries_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+};
+
+struct DesktopCacheString {
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct DesktopCacheRoot {
+    DesktopCacheString path;
+    uint32_t first_directory;
+    uint32_t directory_count;
+    uint32_t first_entry;
+    uint32_t entry_count;
+};
+
+struct DesktopCacheDirectory {
+    DesktopCacheString path;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+};
+
+struct DesktopCacheEntry {
+    DesktopCacheString path;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t size;
+    uint32_t parsed;
+    uint32_t unused;
+    DesktopCacheString fields[DesktopFieldCount];
+};
+
+// Pointers into the mapped file
+struct DesktopCacheView {
+    const DesktopCacheHeader *header = nullptr;
+    const DesktopCacheRoot *roots = nullptr;
+    const DesktopCacheDirectory *directories = nullptr;
+    const DesktopCacheEntry *entries = nullptr;
+    const char *strings = nullptr;
+
+    [[nodiscard]] std::string_view string(const DesktopCacheString &string) const {
+        return {strings + string.offset, string.length};
+    }
+};
+
+struct ScannedDirectory {
+    std::string path;
+    struct timespec mtime;
+};
+
+// What was found under one root, the way it gets written to the cache
+struct ScannedRoot {
+    std::string path;
+    std::vector<ScannedDirectory> directories;
+    size_t first_entry = 0;
+    size_t entry_count = 0;
+};
+
+static std::string desktop_cache_path(bool create_directories) {
+    const char *home_directory = getenv("HOME");
+    if (!home_directory)
+        return "";
+    std::string path(home_directory);
+    path += "/.cache";
+    if (create_directories && mkdir(path.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) == -1)
+        if (errno != EEXIST)
+            return "";
+    path += "/winbar";
+    if (create_directories && mkdir(path.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) == -1)
+        if (errno != EEXIST)
+            return "";
+    path += "/desktop_entries";
+    return path;
+}
+
+static bool view_desktop_cache(const char *data, size_t size, DesktopCacheView *view) {
+    if (size < sizeof(DesktopCacheHeader))
+        return false;
+    auto header = reinterpret_cast<const DesktopCacheHeader *>(data);
+    if (memcmp(header->magic, "WBDESKT", 8) != 0 || header->version != desktop_cache_version ||
+        header->file_size != size)
+        return false;
+    auto section_fits = [header](uint64_t offset, uint64_t count, uint64_t size) {
+        return offset % 8 == 0 && offset <= header->file_size && count <= (header->file_size - offset) / size;
+    };
+    if (!section_fits(header->roots_offset, header->root_count, sizeof(DesktopCacheRoot)) ||
+        !section_fits(header->directories_offset, header->directory_count, sizeof(DesktopCacheDirectory)) ||
+        !section_fits(header->entries_offset, header->entry_count, sizeof(DesktopCacheEntry)) ||
+        !section_fits(header->strings_offset, header->strings_size, 1))
+        return false;
+
+    view->header = header;
+    view->roots = reinterpret_cast<const DesktopCacheRoot *>(data + header->roots_offset);
+    view->directories = reinterpret_cast<const DesktopCacheDirectory *>(data + header->directories_offset);
+    view->entries = reinterpret_cast<const DesktopCacheEntry *>(data + header->entries_offset);
+    view->strings = data + header->strings_offset;
+
+    auto string_fits = [header](const DesktopCacheString &string) {
+        return string.offset <= header->strings_size && string.length <= header->strings_size - string.offset;
+    };
+    for (uint32_t i = 0; i < header->root_count; i++) {
+        const auto &root = view->roots[i];
+        if (!string_fits(root.path) || root.first_directory > header->directory_count ||
+            root.directory_count > header->directory_count - root.first_directory ||
+            root.first_entry > header->entry_count || root.entry_count > header->entry_count - root.first_entry)
+            return false;
+    }
+    for (uint32_t i = 0; i < header->directory_count; i++)
+        if (!string_fits(view->directories[i].path))
+            return false;
+    for (uint32_t i = 0; i < header->entry_count; i++) {
+        if (!string_fits(view->entries[i].path))
+            return false;
+        for (const auto &field: view->entries[i].fields)
+            if (!string_fits(field))
+                return false;
+    }
+    return true;
+}
+
+static bool same_time(const struct timespec &a, int64_t sec, int64_t nsec) {
+    return a.tv_sec == sec && a.tv_nsec == nsec;
+}
+
+static bool is_space(char c) {
+    return isspace((unsigned char) c);
+}
+
+static std::string_view strip(std::string_view text) {
+    while (!text.empty() && is_space(text.front()))
+        text.remove_prefix(1);
+    while (!text.empty() && is_space(text.back()))
+        text.remove_suffix(1);
+    return text;
+}
+
+// Where the first of chars, or a ';' comment after whitespace, is in text (text.size() if neither)
+static size_t find_chars_or_comment(std::string_view text, std::string_view chars) {
+    bool was_space = false;
+    for (size_t i = 0; i < text.size(); i++) {
+        if (chars.find(text[i]) != std::string_view::npos || (was_space && text[i] == ';'))
+            return i;
+        was_space = is_space(text[i]);
+    }
+    return text.size();
+}
+
+static bool equals_ignoring_case(std::string_view a, std::string_view b) {
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); i++)
+        if (tolower((unsigned char) a[i]) != tolower((unsigned char) b[i]))
+            return false;
+    return true;
+}
+
+// Reads the [Desktop Entry] keys out of a .desktop file, following the same rules INIReader does (comments, inline
+// comments, continuation lines, "name: value", repeated keys joined by newlines, case insensitive names) so the values
+// come out exactly as they used to. Everything after the [Desktop Entry] section is skipped.
+static void scan_desktop_entry(std::string_view text, DesktopEntry *entry) {
+    entry->parsed = true;
+    bool in_desktop_entry = false;
+    // The field the last "name=value" line set (or -1 if it wasn't one we keep), for continuation lines
+    int previous_field = -1;
+    bool has_previous_name = false;
+    auto add_value = [entry](int field, std::string_view value) {
+        if (field == -1)
+            return;
+        auto &current = entry->fields[field];
+        if (!current.empty())
+            current += '\n';
+        current.append(value);
+    };
+
+    bool first_line = true;
+    while (!text.empty()) {
+        size_t newline = text.find('\n');
+        std::string_view line = text.substr(0, newline);
+        text.remove_prefix(newline == std::string_view::npos ? text.size() : newline + 1);
+        if (first_line && line.size() >= 3 && line.compare(0, 3, "\xEF\xBB\xBF") == 0)
+            line.remove_prefix(3);
+        first_line = false;
+
+        std::string_view start = strip(line);
+        bool indented = !start.empty() && start.data() > line.data();
+        if (start.empty() || start[0] == ';' || start[0] == '#')
+            continue;
+        if (has_previous_name && indented) {
+            if (in_desktop_entry)
+                add_value(previous_field, strip(start.substr(0, find_chars_or_comment(start, ""))));
+            continue;
+        }
+        if (start[0] == '[') {
+            size_t end = find_chars_or_comment(start.substr(1), "]") + 1;
+            if (end >= start.size() || start[end] != ']') {
+                entry->parsed = false;
+                return;
+            }
+            if (in_desktop_entry)
+                return;
+            in_desktop_entry = equals_ignoring_case(start.substr(1, end - 1), "Desktop Entry");
+            has_previous_name = false;
+            continue;
+        }
+
+        size_t end = find_chars_or_comment(start, "=:");
+        if (end >= start.size() || (start[end] != '=' && start[end] != ':')) {
+            entry->parsed = false;
+            return;
+        }
+        has_previous_name = true;
+        previous_field = -1;
+        if (!in_desktop_entry)
+            continue;
+        std::string_view name = strip(start.substr(0, end));
+        std::string_view value = strip(start.substr(end + 1));
+        value = strip(value.substr(0, find_chars_or_comment(value, "")));
+        for (int i = 0; i < DesktopFieldCount; i++) {
+            if (equals_ignoring_case(name, desktop_field_keys[i])) {
+                previous_field = i;
+                break;
+            }
+        }
+        add_value(previous_field, value);
+    }
+}
+
+static void parse_desktop_entry(DesktopEntry *entry) {
+    for (auto &field: entry->fields)
+        field.clear();
+    entry->parsed = false;
+    int fd = open(entry->path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return;
+    struct stat info{};
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return;
+    }
+    if (info.st_size == 0) {
+        close(fd);
+        entry->parsed = true;
+        return;
+    }
+    void *map = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return;
+    scan_desktop_entry(std::string_view((const char *) map, info.st_size), entry);
+    munmap(map, info.st_size);
+}
+
+// Parses entries[i] for every i in indexes, spread over a few threads since it's mostly waiting on the disk
+static void parse_desktop_entries(std::vector<DesktopEntry> &entries, const std::vector<size_t> &indexes) {
+#ifdef TRACY_ENABLE
+    ZoneScoped;
+#endif
+    std::atomic<size_t> next = 0;
+    auto worker = [&entries, &indexes, &next]() {
+        for (size_t i = next++; i < indexes.size(); i = next++)
+            parse_desktop_entry(&entries[indexes[i]]);
+    };
+
+    // Not worth starting threads for the couple of files that usually change between runs
+    int thread_count = std::max(1, std::min({8, (int) std::thread::hardware_concurrency(), (int) indexes.size() / 32}));
+    std::vector<std::thread> threads;
+    for (int i = 1; i < thread_count; i++)
+        threads.emplace_back(worker);
+    worker();
+    for (auto &thread: threads)
+        thread.join();
+}
+
+static void entry_from_cache(const DesktopCacheView &view, const DesktopCacheEntry &cached, DesktopEntry *entry) {
+    entry->parsed = cached.parsed;
+    for (int i = 0; i < DesktopFieldCount; i++)
+        entry->fields[i] = view.string(cached.fields[i]);
+}
+
+// If none of the folders that were under root last time changed, nothing was added, removed or renamed in it
+static bool root_unchanged(const DesktopCacheView &view, const DesktopCacheRoot &root) {
+    if (root.directory_count == 0)
+        return false;
+    for (uint32_t i = root.first_directory; i < root.first_directory + root.directory_count; i++) {
+        const auto &directory = view.directories[i];
+        struct stat info{};
+        if (stat(std::string(view.string(directory.path)).c_str(), &info) != 0 ||
+            !same_time(info.st_mtim, directory.mtime_sec, directory.mtime_nsec))
+            return false;
+    }
+    return true;
+}
+
+static void walk_root(ScannedRoot *root, std::vector<DesktopEntry> &entries) {
+    std::string directory = root->path;
+    if (!directory.empty() && directory[directory.size() - 1] != '/')
+        directory += '/';
+    struct stat info{};
+    if (stat(directory.c_str(), &info) != 0)
+        return;
+    root->directories.push_back({directory, info.st_mtim});
+    try {
+        for (const auto &item: std::filesystem::recursive_directory_iterator(
+                directory, std::filesystem::directory_options::follow_directory_symlink)) {
+            std::string path = item.path().string();
+            if (item.is_directory()) {
+                if (stat(path.c_str(), &info) == 0)
+                    root->directories.push_back({path, info.st_mtim});
+                continue;
+            }
+            if (!item.is_regular_file())
+                continue;
+            auto filename = item.path().filename().string();
+            if (filename.size() < 8 || filename.compare(filename.size() - 8, 8, ".desktop") != 0)
+                continue;
+            if (stat(path.c_str(), &info) != 0)
+                continue;
+            DesktopEntry entry;
+            entry.path = path;
+            entry.mtime = info.st_mtim;
+            entry.size = info.st_size;
+            entries.push_back(std::move(entry));
+        }
+    } catch (const std::filesystem::filesystem_error &e) {
+
+    }
+}
+
+static void save_desktop_cache(const std::vector<ScannedRoot> &roots, const std::vector<DesktopEntry> &entries) {
+#ifdef TRACY_ENABLE
+    ZoneScoped;
+#endif
+    std::string path = desktop_cache_path(true);
+    if (path.empty())
+        return;
+
+    std::string strings;
+    auto add_string = [&strings](std::string_view string) {
+        DesktopCacheString result = {(uint32_t) strings.size(), (uint32_t) string.size()};
+        strings.append(string);
+        return result;
+    };
+
+    std::vector<DesktopCacheRoot> cache_roots;
+    std::vector<DesktopCacheDirectory> cache_directories;
+    for (const auto &root: roots) {
+        DesktopCacheRoot cache_root = {};
+        cache_root.path = add_string(root.path);
+        cache_root.first_directory = cache_directories.size();
+        cache_root.directory_count = root.directories.size();
+        cache_root.first_entry = root.first_entry;
+        cache_root.entry_count = root.entry_count;
+        cache_roots.push_back(cache_root);
+        for (const auto &directory: root.directories)
+            cache_directories.push_back({add_string(directory.path), directory.mtime.tv_sec, directory.mtime.tv_nsec});
+    }
+    std::vector<DesktopCacheEntry> cache_entries;
+    cache_entries.reserve(entries.size());
+    for (const auto &entry: entries) {
+        DesktopCacheEntry cache_entry = {};
+        cache_entry.path = add_string(entry.path);
+        cache_entry.mtime_sec = entry.mtime.tv_sec;
+        cache_entry.mtime_nsec = entry.mtime.tv_nsec;
+        cache_entry.size = entry.size;
+        cache_entry.parsed = entry.parsed;
+        for (int i = 0; i < DesktopFieldCount; i++)
+            cache_entry.fields[i] = add_string(entry.fields[i]);
+        cache_entries.push_back(cache_entry);
+    }
+
+    auto align = [](uint64_t offset) { return (offset + 7) & ~((uint64_t) 7); };
+    DesktopCacheHeader header = {};
+    memcpy(header.magic, "WBDESKT", 8);
+    header.version = desktop_cache_version;
+    header.root_count = cache_roots.size();
+    header.directory_count = cache_directories.size();
+    header.entry_count = cache_entries.size();
+    header.roots_offset = align(sizeof(DesktopCacheHeader));
+    header.directories_offset = align(header.roots_offset + cache_roots.size() * sizeof(DesktopCacheRoot));
+    header.entries_offset = align(header.directories_offset + cache_directories.size() * sizeof(DesktopCacheDirectory));
+    header.strings_offset = align(header.entries_offset + cache_entries.size() * sizeof(DesktopCacheEntry));
+    header.strings_size = strings.size();
+    header.file_size = header.strings_offset + strings.size();
+
+    std::ofstream file(path + ".tmp", std::ios_base::out | std::ios_base::binary);
+    if (!file.is_open())
+        return;
+    uint64_t written = 0;
+    auto write_section = [&file, &written](uint64_t offset, const void *section, size_t size) {
+        static const char padding[8] = {};
+        file.write(padding, offset - written);
+        file.write(reinterpret_cast<const char *>(section), size);
+        written = offset + size;
+    };
+    write_section(0, &header, sizeof(header));
+    write_section(header.roots_offset, cache_roots.data(), cache_roots.size() * sizeof(DesktopCacheRoot));
+    write_section(header.directories_offset, cache_directories.data(),
+                  cache_directories.size() * sizeof(DesktopCacheDirectory));
+    write_section(header.entries_offset, cache_entries.data(), cache_entries.size() * sizeof(DesktopCacheEntry));
+    write_section(header.strings_offset, strings.data(), strings.size());
+    file.close();
+    if (file)
+        rename((path + ".tmp").c_str(), path.c_str());
+}
+
+void desktop_entries_load(const std::vector<std::string> &directories, std::vector<DesktopEntry> &entries,
+                          std::vector<std::string> *folders) {
+#ifdef TRACY_ENABLE
+    ZoneScoped;
+#endif
+    char *map = nullptr;
+    size_t map_size = 0;
+    DesktopCacheView view;
+    std::string path = desktop_cache_path(false);
+    int fd = path.empty() ? -1 : open(path.c_str(), O_RDONLY);
+    if (fd != -1) {
+        struct stat info{};
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            map_size = info.st_size;
+            map = (char *) mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map == MAP_FAILED)
+                map = nullptr;
+        }
+        close(fd);
+    }
+    if (map && !view_desktop_cache(map, map_size, &view))
+        view = DesktopCacheView();
+
+    // The same file can be under more than one root (symlinks), so entries are found by path
+    std::unordered_map<std::string_view, const DesktopCacheEntry *> cached_entries;
+    if (view.header)
+        for (uint32_t i = 0; i < view.header->entry_count; i++)
+            cached_entries[view.string(view.entries[i].path)] = &view.entries[i];
+
+    bool changed = !view.header || view.header->root_count != directories.size();
+    std::vector<ScannedRoot> roots;
+    for (int r = 0; r < directories.size(); r++) {
+        ScannedRoot root;
+        root.path = directories[r];
+        root.first_entry = entries.size();
+
+        const DesktopCacheRoot *cached_root = nullptr;
+        if (view.header && r < view.header->root_count && view.string(view.roots[r].path) == root.path)
+            cached_root = &view.roots[r];
+        if (!cached_root)
+            changed = true;
+
+        if (cached_root && root_unchanged(view, *cached_root)) {
+            for (uint32_t i = cached_root->first_directory;
+                 i < cached_root->first_directory + cached_root->directory_count; i++) {
+                const auto &directory = view.directories[i];
+                root.directories.push_back({std::string(view.string(directory.path)),
+                                            {(time_t) directory.mtime_sec, (long) directory.mtime_nsec}});
+            }
+            for (uint32_t i = cached_root->first_entry; i < cached_root->first_entry + cached_root->entry_count; i++) {
+                DesktopEntry entry;
+                entry.path = view.string(view.entries[i].path);
+                struct stat info{};
+                if (stat(entry.path.c_str(), &info) != 0) {
+                    changed = true;
+                    continue;
+                }
+                entry.mtime = info.st_mtim;
+                entry.size = info.st_size;
+                entries.push_back(std::move(entry));
+            }
+        } else {
+            changed = true;
+            walk_root(&root, entries);
+        }
+        root.entry_count = entries.size() - root.first_entry;
+        roots.push_back(std::move(root));
+    }
+
+    // Only files that are new or were modified get parsed
+    std::vector<size_t> unparsed;
+    for (size_t i = 0; i < entries.size(); i++) {
+        auto &entry = entries[i];
+        auto found = cached_entries.find(entry.path);
+        if (found != cached_entries.end() && same_time(entry.mtime, found->second->mtime_sec, found->second->mtime_nsec) &&
+            entry.size == found->second->size) {
+            entry_from_cache(view, *found->second, &entry);
+        } else {
+            unparsed.push_back(i);
+        }
+    }
+    if (!unparsed.empty()) {
+        changed = true;
+        parse_desktop_entries(entries, unparsed);
+    }
+
+    if (folders)
+        for (const auto &root: roots)
+            for (const auto &directory: root.directories)
+                folders->push_back(directory.path);
+
+    if (map)
+        munmap(map, map_size);
+    if (changed)
+        save_desktop_cache(roots, entries);
+}
@@ -0,0 +1,54 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#ifndef WINBAR_DESKTOP_ENTRY_CACHE_H
+#define WINBAR_DESKTOP_ENTRY_CACHE_H
+
+#include <string>
+#include <vector>
+#include <ctime>
+#include <sys/types.h>
+
+// The keys of [Desktop Entry] the start menu uses.
+enum DesktopField {
+    DesktopName,
+    DesktopStartupWMClass,
+    DesktopExec,
+    DesktopKeywords,
+    DesktopCategories,
+    DesktopGenericName,
+    DesktopIcon,
+    DesktopNoDisplay,
+    DesktopNotShowIn,
+    DesktopOnlyShowIn,
+
+    DesktopFieldCount
+};
+
+// The raw values of one .desktop file (whether it should be shown is up to the caller since that depends on settings).
+struct DesktopEntry {
+    std::string path;
+    struct timespec mtime = {};
+    off_t size = 0;
+    // False if the file couldn't be parsed
+    bool parsed = false;
+    std::string fields[DesktopFieldCount];
+
+    [[nodiscard]] const std::string &get(DesktopField field) const {
+        return fields[field];
+    }
+};
+
+// Reads every .desktop file under each of directories (recursively, following symlinks) into entries, in the order
+// they are found.
+//
+// The results are kept in ~/.cache/winbar/desktop_entries together with the modification times of every folder. If no
+// folder under a directory changed, its files are taken from the cache without walking it, and only the files whose
+// modification time or size changed are parsed again.
+//
+// If folders isn't null, every folder found under directories (and the directories themselves) is added to it.
+void desktop_entries_load(const std::vector<std::string> &directories, std::vector<DesktopEntry> &entries,
+                          std::vector<std::string> *folders = nullptr);
+
+#endif //WINBAR_DESKTOP_ENTRY_CACHE_H
@@ -3,6 +3,7 @@
 //
 
 #include "drawer.h"
+#include "icon_loader.h"
 
 #ifdef TRACY_ENABLE
 #include <tracy/Tracy.hpp>
@@ -77,7 +78,8 @@ void draw_gl_texture(AppClient *client, gl_surface *gl_surf, cairo_surface_t *su
     ZoneScoped;
 #endif
     
-    if (!surf)
+    // Nothing to show yet, and uploading the placeholder would leave a blank texture behind once the icon arrives
+    if (!surf || icon_load_pending(surf))
         return;
     ClientTexture *tex_target = nullptr;
     for (int i = gl_surf->textures.size() - 1; i >= 0; i--) {
@@ -97,7 +99,6 @@ void draw_gl_texture(AppClient *client, gl_surface *gl_surf, cairo_surface_t *su
             gl_surf->creation_client = client;
             
             auto tex = new ClientTexture;
-            tex->texture = new ImmediateTexture;
             tex->client = client;
             tex->lifetime = client->lifetime;
             tex_target = tex;
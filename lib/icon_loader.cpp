@@ -0,0 +1,198 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#include "icon_loader.h"
+#include "icon_pixmap_cache.h"
+#include "utility.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#ifdef TRACY_ENABLE
+
+#include "../tracy/public/tracy/Tracy.hpp"
+
+#endif
+
+struct IconJob {
+    std::string path;
+    int size = 0;
+    // Surfaces handed out as placeholders
+    std::vector<cairo_surface_t *> waiters;
+    cairo_surface_t *decoded = nullptr;
+    bool success = false;
+};
+
+// Never destroyed: the detached workers are still waiting on them when the program exits, and destroying a condition
+// variable someone waits on hangs
+static std::mutex &jobs_mutex = *new std::mutex;
+static std::condition_variable &jobs_condition = *new std::condition_variable;
+static std::deque<IconJob *> pending_jobs;
+static std::deque<IconJob *> finished_jobs;
+// Jobs that haven't been handed back to the main thread yet, so new requests can join them
+static std::map<std::pair<std::string, int>, IconJob *> jobs_in_flight;
+static bool workers_started = false;
+
+// A worker writes a byte into it whenever a job finishes to wake up the main thread's poll
+static int finished_pipe[2] = {-1, -1};
+
+// Set on placeholders until the icon is painted into them: the windows of the clients that should repaint once it is
+static cairo_user_data_key_t pending_key;
+
+static void destroy_pending_windows(void *windows) {
+    delete (std::vector<xcb_window_t> *) windows;
+}
+
+static void worker() {
+    while (true) {
+        IconJob *job;
+        {
+            std::unique_lock<std::mutex> lock(jobs_mutex);
+            jobs_condition.wait(lock, []() { return !pending_jobs.empty(); });
+            job = pending_jobs.front();
+            pending_jobs.pop_front();
+        }
+
+        {
+#ifdef TRACY_ENABLE
+            ZoneScopedN("decode icon");
+#endif
+            job->decoded = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, job->size, job->size);
+            job->success = paint_surface_with_image(job->decoded, job->path, job->size, nullptr);
+            if (job->success)
+                icon_pixmap_cache_store(job->path, job->size, job->decoded);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(jobs_mutex);
+            jobs_in_flight.erase({job->path, job->size});
+            finished_jobs.push_back(job);
+        }
+        char byte = 1;
+        write(finished_pipe[1], &byte, 1);
+    }
+}
+
+static void jobs_finished_wakeup(App *app, int fd, void *) {
+#ifdef TRACY_ENABLE
+    ZoneScoped;
+#endif
+    char buffer[64];
+    while (read(fd, buffer, sizeof(buffer)) > 0) {}
+
+    std::deque<IconJob *> finished;
+    {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+        finished.swap(finished_jobs);
+    }
+    std::vector<xcb_window_t> refresh;
+    for (auto job: finished) {
+        for (auto waiter: job->waiters) {
+            // If we hold the only reference, whoever asked for the icon doesn't need it anymore
+            if (job->success && cairo_surface_get_reference_count(waiter) > 1) {
+                cairo_t *cr = cairo_create(waiter);
+                cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+                cairo_set_source_surface(cr, job->decoded, 0, 0);
+                cairo_paint(cr);
+                cairo_destroy(cr);
+                cairo_surface_flush(waiter);
+                if (auto windows = (std::vector<xcb_window_t> *) cairo_surface_get_user_data(waiter, &pending_key))
+                    for (auto window: *windows)
+                        if (std::find(refresh.begin(), refresh.end(), window) == refresh.end())
+                            refresh.push_back(window);
+            }
+            cairo_surface_set_user_data(waiter, &pending_key, nullptr, nullptr);
+            cairo_surface_destroy(waiter);
+        }
+        cairo_surface_destroy(job->decoded);
+        delete job;
+    }
+    for (auto window: refresh)
+        if (auto client = client_by_window(app, window))
+            request_refresh(app, client);
+}
+
+static void start_workers(App *app) {
+    if (!workers_started) {
+        workers_started = true;
+        if (pipe2(finished_pipe, O_NONBLOCK | O_CLOEXEC) == -1) {
+            perror("pipe2");
+        } else {
+            // Decoding is mostly waiting on the disk and librsvg, so a few threads is plenty
+            int count = std::clamp((int) std::thread::hardware_concurrency() / 2, 1, 4);
+            for (int i = 0; i < count; i++)
+                std::thread(worker).detach();
+        }
+    }
+    // The workers outlive an in-process restart, but the new App has to be told about the pipe again
+    if (finished_pipe[0] != -1) {
+        bool polled = false;
+        for (const auto &descriptor: app->descriptors_being_polled)
+            if (descriptor.file_descriptor == finished_pipe[0])
+                polled = true;
+        if (!polled)
+            poll_descriptor(app, finished_pipe[0], EPOLLIN, jobs_finished_wakeup, nullptr, "Icon loader");
+    }
+}
+
+cairo_surface_t *icon_load_async(App *app, AppClient *client, const std::string &path, int size) {
+#ifdef TRACY_ENABLE
+    ZoneScoped;
+#endif
+    if (auto cached = icon_pixmap_cache_lookup(path, size))
+        return cached;
+
+    auto surface = accelerated_surface(app, client, size, size);
+    if (!surface)
+        return nullptr;
+    start_workers(app);
+    // Couldn't start the workers, so just do it right here
+    if (finished_pipe[0] == -1) {
+        if (paint_surface_with_image(surface, path, size, nullptr))
+            icon_pixmap_cache_store(path, size, surface);
+        return surface;
+    }
+
+    auto windows = new std::vector<xcb_window_t>;
+    if (client)
+        windows->push_back(client->window);
+    cairo_surface_set_user_data(surface, &pending_key, windows, destroy_pending_windows);
+    auto waiter = cairo_surface_reference(surface);
+    {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+        auto found = jobs_in_flight.find({path, size});
+        if (found != jobs_in_flight.end()) {
+            found->second->waiters.push_back(waiter);
+            return surface;
+        }
+        auto job = new IconJob;
+        job->path = path;
+        job->size = size;
+        job->waiters.push_back(waiter);
+        jobs_in_flight[{path, size}] = job;
+        pending_jobs.push_back(job);
+    }
+    jobs_condition.notify_one();
+    return surface;
+}
+
+bool icon_load_pending(cairo_surface_t *surface) {
+    return surface && cairo_surface_get_user_data(surface, &pending_key) != nullptr;
+}
+
+void icon_load_notify(AppClient *client, cairo_surface_t *surface) {
+    if (!client || !surface)
+        return;
+    if (auto windows = (std::vector<xcb_window_t> *) cairo_surface_get_user_data(surface, &pending_key))
+        if (std::find(windows->begin(), windows->end(), client->window) == windows->end())
+            windows->push_back(client->window);
+}
@@ -0,0 +1,30 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#ifndef WINBAR_ICON_LOADER_H
+#define WINBAR_ICON_LOADER_H
+
+#include "application.h"
+
+#include <cairo.h>
+#include <string>
+
+// Returns a size x size surface for the icon at path right away.
+//
+// If the icon is in the pixmap cache the surface already has it. Otherwise the surface starts out transparent, the icon
+// is decoded on a worker thread, painted into that same surface on the main thread, and client (if it still exists) is
+// asked to repaint. Requests for a path and size that's already being decoded wait on that decode instead of starting
+// another one.
+//
+// Returns nullptr if the surface couldn't be created (same as accelerated_surface).
+cairo_surface_t *icon_load_async(App *app, AppClient *client, const std::string &path, int size);
+
+// If surface came from icon_load_async and the icon hasn't been painted into it yet.
+bool icon_load_pending(cairo_surface_t *surface);
+
+// Asks client to repaint as well once the icon is painted into surface (if it's still pending). For surfaces that are
+// shared between clients, since only the client that asked for it is repainted otherwise.
+void icon_load_notify(AppClient *client, cairo_surface_t *surface);
+
+#endif //WINBAR_ICON_LOADER_H
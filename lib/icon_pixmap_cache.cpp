@@ -0,0 +1,347 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#include "icon_pixmap_cache.h"
+#include "utility.h"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <fstream>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef TRACY_ENABLE
+
+#include "../tracy/public/tracy/Tracy.hpp"
+
+#endif
+
+// Bump if the layout of the pack changes.
+static uint32_t pack_version = 1;
+
+// Layout of the pack file:
+//
+//   PackHeader
+//   PackEntry[count]     sorted by key (a hash of the path and size), so lookups are a binary search
+//   char paths[]
+//   pixels               each entry's pixels start 16 byte aligned, so they can be handed to cairo as they are
+struct PackHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t file_size;
+};
+
+struct PackEntry {
+    uint64_t key;
+    uint32_t path_offset;
+    uint32_t path_length;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint32_t size;
+    uint32_t stride;
+    uint64_t pixels_offset;
+};
+
+// A mapped pack, kept alive until the last surface wrapping its pixels is destroyed
+struct Pack {
+    char *map = nullptr;
+    size_t map_size = 0;
+    const PackHeader *header = nullptr;
+    const PackEntry *entries = nullptr;
+    std::atomic<int> references = 1;
+};
+
+struct StoredPixmap {
+    std::string path;
+    int size = 0;
+    int stride = 0;
+    struct timespec mtime = {};
+    std::vector<unsigned char> pixels;
+};
+
+static std::mutex pack_mutex;
+static Pack *current_pack = nullptr;
+static bool pack_loaded = false;
+static std::map<std::pair<std::string, int>, StoredPixmap> stored_pixmaps;
+static cairo_user_data_key_t pack_key;
+
+static std::string pack_path(bool create_directories) {
+    const char *home_directory = getenv("HOME");
+    if (!home_directory)
+        return "";
+    std::string path(home_directory);
+    path += "/.cache";
+    if (create_directories && mkdir(path.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) == -1)
+        if (errno != EEXIST)
+            return "";
+    path += "/winbar";
+    if (create_directories && mkdir(path.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) == -1)
+        if (errno != EEXIST)
+            return "";
+    path += "/icon_pixmaps";
+    return path;
+}
+
+static uint64_t pixmap_key(const std::string &path, int size) {
+    uint64_t hash = 14695981039346656037ull;
+    for (char c: path) {
+        hash ^= (unsigned char) c;
+        hash *= 1099511628211ull;
+    }
+    hash ^= (uint64_t) size;
+    hash *= 1099511628211ull;
+    return hash;
+}
+
+static void release_pack(Pack *pack) {
+    if (pack && --pack->references == 0) {
+        munmap(pack->map, pack->map_size);
+        delete pack;
+    }
+}
+
+static Pack *map_pack() {
+#ifdef TRACY_ENABLE
+    ZoneScoped;
+#endif
+    std::string path = pack_path(false);
+    if (path.empty())
+        return nullptr;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return nullptr;
+    struct stat pack_stat{};
+    if (fstat(fd, &pack_stat) != 0 || pack_stat.st_size < (off_t) sizeof(PackHeader)) {
+        close(fd);
+        return nullptr;
+    }
+    size_t size = pack_stat.st_size;
+    // Private and writable, so callers can draw into the surfaces without touching the file
+    auto map = (char *) mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return nullptr;
+
+    auto header = reinterpret_cast<const PackHeader *>(map);
+    if (memcmp(header->magic, "WBPIXMP", 8) != 0 || header->version != pack_version || header->file_size != size ||
+        header->count > (size - sizeof(PackHeader)) / sizeof(PackEntry)) {
+        munmap(map, size);
+        return nullptr;
+    }
+    auto entries = reinterpret_cast<const PackEntry *>(map + sizeof(PackHeader));
+    for (uint32_t i = 0; i < header->count; i++) {
+        const PackEntry &entry = entries[i];
+        if (entry.path_offset > size || entry.path_length > size - entry.path_offset ||
+            entry.pixels_offset % 16 != 0 || entry.pixels_offset > size ||
+            (uint64_t) entry.stride * entry.size > size - entry.pixels_offset ||
+            entry.stride != (uint32_t) cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, entry.size)) {
+            munmap(map, size);
+            return nullptr;
+        }
+    }
+
+    auto pack = new Pack;
+    pack->map = map;
+    pack->map_size = size;
+    pack->header = header;
+    pack->entries = entries;
+    return pack;
+}
+
+static const PackEntry *find_entry(const Pack *pack, const std::string &path, int size) {
+    uint64_t key = pixmap_key(path, size);
+    auto end = pack->entries + pack->header->count;
+    auto found = std::lower_bound(pack->entries, end, key, [](const PackEntry &entry, uint64_t key) {
+        return entry.key < key;
+    });
+    for (; found != end && found->key == key; found++) {
+        if (found->size == (uint32_t) size && found->path_length == path.size() &&
+            memcmp(pack->map + found->path_offset, path.data(), path.size()) == 0)
+            return found;
+    }
+    return nullptr;
+}
+
+cairo_surface_t *icon_pixmap_cache_lookup(const std::string &path, int size) {
+#ifdef TRACY_ENABLE
+    ZoneScoped;
+#endif
+    if (path.empty() || size <= 0)
+        return nullptr;
+    struct stat file_stat{};
+    if (stat(path.c_str(), &file_stat) != 0)
+        return nullptr;
+
+    std::lock_guard lock(pack_mutex);
+    if (!pack_loaded) {
+        pack_loaded = true;
+        current_pack = map_pack();
+    }
+    if (!current_pack)
+        return nullptr;
+    const PackEntry *entry = find_entry(current_pack, path, size);
+    if (!entry || entry->mtime_sec != file_stat.st_mtim.tv_sec || entry->mtime_nsec != file_stat.st_mtim.tv_nsec)
+        return nullptr;
+
+    auto surface = cairo_image_surface_create_for_data((unsigned char *) current_pack->map + entry->pixels_offset,
+                                                       CAIRO_FORMAT_ARGB32, size, size, entry->stride);
+    if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+        cairo_surface_destroy(surface);
+        return nullptr;
+    }
+    current_pack->references++;
+    cairo_surface_set_user_data(surface, &pack_key, current_pack, [](void *data) {
+        release_pack((Pack *) data);
+    });
+    return surface;
+}
+
+void icon_pixmap_cache_store(const std::string &path, int size, cairo_surface_t *surface) {
+    if (path.empty() || !surface || cairo_image_surface_get_width(surface) != size ||
+        cairo_image_surface_get_height(surface) != size ||
+        cairo_image_surface_get_format(surface) != CAIRO_FORMAT_ARGB32)
+        return;
+    struct stat file_stat{};
+    if (stat(path.c_str(), &file_stat) != 0)
+        return;
+
+    cairo_surface_flush(surface);
+    StoredPixmap stored;
+    stored.path = path;
+    stored.size = size;
+    stored.stride = cairo_image_surface_get_stride(surface);
+    stored.mtime = file_stat.st_mtim;
+    auto data = cairo_image_surface_get_data(surface);
+    stored.pixels.assign(data, data + stored.stride * size);
+
+    std::lock_guard lock(pack_mutex);
+    stored_pixmaps[{path, size}] = std::move(stored);
+}
+
+cairo_surface_t *icon_pixmap_cache_surface(const std::string &path, int size) {
+#ifdef TRACY_ENABLE
+    ZoneScoped;
+#endif
+    if (auto surface = icon_pixmap_cache_lookup(path, size))
+        return surface;
+    auto surface = accelerated_surface(nullptr, nullptr, size, size);
+    if (!surface)
+        return nullptr;
+    if (paint_surface_with_image(surface, path, size, nullptr))
+        icon_pixmap_cache_store(path, size, surface);
+    return surface;
+}
+
+void icon_pixmap_cache_flush() {
+#ifdef TRACY_ENABLE
+    ZoneScoped;
+#endif
+    std::map<std::pair<std::string, int>, StoredPixmap> stored;
+    Pack *old_pack;
+    {
+        std::lock_guard lock(pack_mutex);
+        if (stored_pixmaps.empty())
+            return;
+        stored.swap(stored_pixmaps);
+        old_pack = current_pack;
+        if (old_pack)
+            old_pack->references++;
+    }
+
+    // What goes in the new pack: the new pixmaps, and the old entries whose files haven't changed since
+    struct Item {
+        uint64_t key;
+        std::string path;
+        int size;
+        int stride;
+        struct timespec mtime;
+        const unsigned char *pixels;
+    };
+    std::vector<Item> items;
+    for (const auto &[key, pixmap]: stored)
+        items.push_back({pixmap_key(pixmap.path, pixmap.size), pixmap.path, pixmap.size, pixmap.stride,
+                         pixmap.mtime, pixmap.pixels.data()});
+    if (old_pack) {
+        for (uint32_t i = 0; i < old_pack->header->count; i++) {
+            const PackEntry &entry = old_pack->entries[i];
+            std::string path(old_pack->map + entry.path_offset, entry.path_length);
+            if (stored.count({path, (int) entry.size}))
+                continue;
+            struct stat file_stat{};
+            if (stat(path.c_str(), &file_stat) != 0 || file_stat.st_mtim.tv_sec != entry.mtime_sec ||
+                file_stat.st_mtim.tv_nsec != entry.mtime_nsec)
+                continue;
+            items.push_back({entry.key, path, (int) entry.size, (int) entry.stride,
+                             {(time_t) entry.mtime_sec, (long) entry.mtime_nsec},
+                             (const unsigned char *) old_pack->map + entry.pixels_offset});
+        }
+    }
+    std::sort(items.begin(), items.end(), [](const Item &a, const Item &b) { return a.key < b.key; });
+
+    std::string paths;
+    std::vector<PackEntry> entries;
+    uint64_t pixels_offset = sizeof(PackHeader) + items.size() * sizeof(PackEntry);
+    for (const auto &item: items)
+        pixels_offset += item.path.size();
+    for (const auto &item: items) {
+        pixels_offset = (pixels_offset + 15) & ~((uint64_t) 15);
+        PackEntry entry = {};
+        entry.key = item.key;
+        entry.path_offset = sizeof(PackHeader) + items.size() * sizeof(PackEntry) + paths.size();
+        entry.path_length = item.path.size();
+        entry.mtime_sec = item.mtime.tv_sec;
+        entry.mtime_nsec = item.mtime.tv_nsec;
+        entry.size = item.size;
+        entry.stride = item.stride;
+        entry.pixels_offset = pixels_offset;
+        entries.push_back(entry);
+        paths += item.path;
+        pixels_offset += (uint64_t) item.stride * item.size;
+    }
+
+    PackHeader header = {};
+    memcpy(header.magic, "WBPIXMP", 8);
+    header.version = pack_version;
+    header.count = entries.size();
+    header.file_size = pixels_offset;
+
+    std::string path = pack_path(true);
+    bool written = false;
+    if (!path.empty()) {
+        std::ofstream file(path + ".tmp", std::ios_base::out | std::ios_base::binary);
+        if (file.is_open()) {
+            uint64_t offset = 0;
+            auto write = [&file, &offset](const void *data, size_t size) {
+                file.write((const char *) data, size);
+                offset += size;
+            };
+            write(&header, sizeof(header));
+            write(entries.data(), entries.size() * sizeof(PackEntry));
+            write(paths.data(), paths.size());
+            static const char padding[16] = {};
+            for (int i = 0; i < items.size(); i++) {
+                write(padding, entries[i].pixels_offset - offset);
+                write(items[i].pixels, (size_t) items[i].stride * items[i].size);
+            }
+            file.close();
+            written = file && rename((path + ".tmp").c_str(), path.c_str()) == 0;
+        }
+    }
+    release_pack(old_pack);
+
+    // Lookups switch over to the new file (surfaces of the old one keep it mapped for as long as they live)
+    std::lock_guard lock(pack_mutex);
+    if (written) {
+        release_pack(current_pack);
+        current_pack = map_pack();
+    }
+}
@@ -0,0 +1,29 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#ifndef WINBAR_ICON_PIXMAP_CACHE_H
+#define WINBAR_ICON_PIXMAP_CACHE_H
+
+#include <cairo.h>
+#include <string>
+
+// Returns a size x size ARGB32 surface of the icon at path. If ~/.cache/winbar/icon_pixmaps has it (for the current
+// modification time of the file) the surface wraps the pixels in the mapped pack file, so nothing is decoded. Otherwise
+// the icon is rasterized with paint_surface_with_image and remembered for the next icon_pixmap_cache_flush.
+//
+// The surface can be drawn into like any other (the mapping is private). Returns nullptr if the surface couldn't be
+// created, and a transparent surface if the icon couldn't be loaded.
+cairo_surface_t *icon_pixmap_cache_surface(const std::string &path, int size);
+
+// Same as above, but only returns the cached surface (nullptr on a miss).
+cairo_surface_t *icon_pixmap_cache_lookup(const std::string &path, int size);
+
+// Remembers the pixels of an icon rasterized at size from path (they are copied).
+void icon_pixmap_cache_store(const std::string &path, int size, cairo_surface_t *surface);
+
+// Writes a new pack file with everything stored since the last flush, plus the entries of the current pack whose
+// icon files haven't changed. Does nothing if nothing was stored. Slow, so call it off the main thread when possible.
+void icon_pixmap_cache_flush();
+
+#endif //WINBAR_ICON_PIXMAP_CACHE_H
@@ -24,6 +24,14 @@
 #include <pango/pangocairo.h>
 #include <math.h>
 #include <unordered_map>
+#include <set>
+#include <deque>
+#include <thread>
+#include <condition_variable>
+#include <mutex>
+#include <iterator>
+#include <sys/inotify.h>
+#include <sys/epoll.h>
 
 #ifdef TRACY_ENABLE
 
@@ -31,7 +39,7 @@
 
 #endif
 
-static uint32_t cache_version = 3;
+static uint32_t cache_version = 5;
 static long last_time_cached_checked = -1;
 
 int getExtension(unsigned short int i) {
@@ -87,121 +95,452 @@ struct OptionsData {
 static std::vector<std::string> icon_search_paths;
 static auto *data = new OptionsData;
 
-char *name_buffer = nullptr;
-char *option_buffer = nullptr;
-struct Range {
-    unsigned long start = -1;
-    unsigned long length = -1;
+// Layout of icon.cache since version 4. Lookups read straight from the mmap of the file, so every section starts
+// 8 byte aligned and nothing has to be parsed or copied when the cache is loaded.
+//
+//   version string ("5\0", padded to 8 bytes since check_cache_file only looks at this part)
+//   IconCacheHeader
+//   IconCacheName[name_count]              sorted by name, so a lookup is a binary search
+//   IconCacheOption[option_count]          the options of a name are next to each other
+//   IconCacheDirectory[directory_count]    every folder an icon was found in
+//   IconCacheString[theme_count]
+//   IconCacheTrigram[trigram_count]        (since version 5) every trigram of the lowercased names, sorted
+//   uint32_t postings[posting_count]       for each trigram, the indexes of the names containing it, ascending
+//   char strings[strings_size]             names, folders and themes (zero terminated)
+struct IconCacheHeader {
+    uint64_t file_size;
+    uint32_t name_count;
+    uint32_t option_count;
+    uint32_t directory_count;
+    uint32_t theme_count;
+    uint64_t names_offset;
+    uint64_t options_offset;
+    uint64_t directories_offset;
+    uint64_t themes_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint32_t trigram_count;
+    uint32_t posting_count;
+    uint64_t trigrams_offset;
+    uint64_t postings_offset;
 };
-std::unordered_map<std::string_view, Range> ranges;
 
-void traverse_dir(const char *path) {
-    DIR *dir = opendir(path);
-    if (dir == nullptr) {
-        return;
+struct IconCacheString {
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct IconCacheName {
+    IconCacheString name;
+    uint32_t first_option;
+    uint32_t option_count;
+};
+
+struct IconCacheOption {
+    uint16_t directory;
+    uint8_t extension;
+    uint8_t unused;
+};
+
+// Size, scale and context only depend on the folder, so they are worked out once when the cache is generated
+struct IconCacheDirectory {
+    IconCacheString path;
+    uint16_t theme;
+    uint16_t size;
+    uint8_t scale;
+    uint8_t context;
+    uint16_t unused;
+};
+
+// Three lowercased bytes of a name, packed as (a << 16) | (b << 8) | c
+struct IconCacheTrigram {
+    uint32_t trigram;
+    uint32_t first_posting;
+    uint32_t posting_count;
+    uint32_t unused;
+};
+
+// Pointers to the sections of a mapped icon.cache
+struct IconCacheView {
+    const IconCacheHeader *header = nullptr;
+    const IconCacheName *names = nullptr;
+    const IconCacheOption *options = nullptr;
+    const IconCacheDirectory *directories = nullptr;
+    const IconCacheString *themes = nullptr;
+    const IconCacheTrigram *trigrams = nullptr;
+    const uint32_t *postings = nullptr;
+    const char *strings = nullptr;
+    
+    [[nodiscard]] std::string_view string(const IconCacheString &string) const {
+        return {strings + string.offset, string.length};
+    }
+};
+
+// One mmap of icon.cache. Candidates hold on to the mapping they were found in, so loading a newer cache only unmaps
+// the old one once nothing points into it anymore.
+struct IconCacheMapping {
+    char *data = nullptr;
+    size_t size = 0;
+    IconCacheView view;
+    // Which file is mapped, so loading the same file again keeps the mapping
+    ino_t inode = 0;
+    struct timespec mtime = {};
+    
+    ~IconCacheMapping() {
+        munmap(data, size);
+    }
+};
+
+// Guards cache (only swapped, never changed in place)
+static std::mutex cache_mutex;
+static std::shared_ptr<const IconCacheMapping> cache;
+// Serializes load_data, so two threads don't both map (or regenerate) the same new file
+static std::mutex load_data_mutex;
+// Serializes check_cache_file
+static std::mutex check_cache_file_mutex;
+
+static std::shared_ptr<const IconCacheMapping> current_cache() {
+    std::lock_guard lock(cache_mutex);
+    return cache;
+}
+
+static const IconCacheName *find_name(const IconCacheView &view, std::string_view name) {
+    if (!view.header)
+        return nullptr;
+    auto end = view.names + view.header->name_count;
+    auto found = std::lower_bound(view.names, end, name, [&view](const IconCacheName &entry, std::string_view name) {
+        return view.string(entry.name) < name;
+    });
+    if (found == end || view.string(found->name) != name)
+        return nullptr;
+    return found;
+}
+
+static uint32_t pack_trigram(const char *text) {
+    return ((uint32_t) std::tolower((unsigned char) text[0]) << 16) |
+           ((uint32_t) std::tolower((unsigned char) text[1]) << 8) |
+           (uint32_t) std::tolower((unsigned char) text[2]);
+}
+
+// Whoever still holds the mapping keeps it until they're done
+static void unmap_cache() {
+    std::lock_guard lock(cache_mutex);
+    cache.reset();
+}
+
+std::string_view Candidate::parent_path() const {
+    if (directory != -1)
+        return mapping->view.string(mapping->view.directories[directory].path);
+    std::string_view view = path;
+    return view.substr(0, view.find_last_of('/'));
+}
+
+std::string_view Candidate::filename() const {
+    if (name != -1)
+        return mapping->view.string(mapping->view.names[name].name);
+    std::string_view view = path;
+    size_t last_slash = view.find_last_of('/');
+    size_t last_dot = view.find_last_of('.');
+    return view.substr(last_slash + 1, last_dot - last_slash - 1);
+}
+
+std::string_view Candidate::theme() const {
+    if (directory != -1)
+        return mapping->view.string(mapping->view.themes[mapping->view.directories[directory].theme]);
+    return "hardcoded";
+}
+
+std::string Candidate::full_path() const {
+    std::string temp = std::string(parent_path()).append("/").append(filename());
+    if (extension == 0) {
+        temp.append(".svg");
+    } else if (extension == 1) {
+        temp.append(".png");
+    } else if (extension == 2) {
+        temp.append(".xpm");
     }
+    temp.erase(std::remove(temp.begin(), temp.end(), '\0'), temp.end());
     
-    std::string path_as_string(path);
+    return temp;
+}
+
+// Icons found directly in one folder
+struct ScannedDirectory {
+    std::string path;
     std::string theme;
-    for (const auto &item: icon_search_paths) {
-        if (path_as_string.find(item) == 0) {
-            theme = path_as_string.substr(item.size());
-            if (theme.empty()) {
-                theme = path;
-            } else {
-                // Remove the first slash
-                theme = theme.substr(1);
-                // Remove everything after slash
-                theme = theme.substr(0, theme.find('/'));
-            }
-            break;
-        }
+    std::vector<std::pair<std::string, int>> icons; // name without extension, extension
+};
+
+// A folder still to be read
+struct PendingDirectory {
+    std::string path;
+    std::string theme;
+    // The folders (device, inode) it was reached through, to notice a symlink pointing back up the tree
+    std::vector<std::pair<dev_t, ino_t>> ancestors;
+};
+
+// Folders still to be read, shared by every traverse_dirs worker
+struct DirectoryQueue {
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<PendingDirectory> pending;
+    int busy = 0;
+    // If the subfolders of a folder are read as well
+    bool recursive = true;
+};
+
+// Returns the extension index if the name is an icon (.svg or .png), or -1
+static int icon_extension(const char *name, size_t name_len) {
+    if (name_len <= 5 || name[name_len - 4] != '.')
+        return -1;
+    const char *extension = name + name_len - 3;
+    if (extension[0] == 's' && extension[1] == 'v' && extension[2] == 'g')
+        return 0;
+    if (extension[0] == 'p' && extension[1] == 'n' && extension[2] == 'g')
+        return 1;
+    return -1;
+}
+
+static void scan_directory(DirectoryQueue *queue, const PendingDirectory &pending,
+                           std::vector<ScannedDirectory> *results) {
+    const std::string &path = pending.path;
+    const std::string &theme = pending.theme;
+    int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+        return;
+    struct stat dir_stat{};
+    if (fstat(fd, &dir_stat) != 0) {
+        close(fd);
+        return;
+    }
+    // Only a symlink back up the tree is skipped. The same folder reached through another path (like Papirus-Dark
+    // linking to Papirus) is read again, since it's recorded with that path and theme.
+    std::pair<dev_t, ino_t> id = {dir_stat.st_dev, dir_stat.st_ino};
+    if (std::find(pending.ancestors.begin(), pending.ancestors.end(), id) != pending.ancestors.end()) {
+        close(fd);
+        return;
+    }
+    DIR *dir = fdopendir(fd);
+    if (dir == nullptr) {
+        close(fd);
+        return;
     }
-    unsigned short int current_theme_index = data->themeIndexOf(theme);
-    unsigned short int current_parent_index = data->parentIndexOf(path);
     
+    // Folders right inside a search path are themes, and everything under them belongs to that theme
+    bool is_search_path = path == theme;
+    ScannedDirectory scanned;
+    std::vector<PendingDirectory> subdirectories;
     struct dirent *entry;
-    struct stat entryStat;
     while ((entry = readdir(dir)) != nullptr) {
         size_t name_len = strlen(entry->d_name);
-        if (name_len > 5) {
-            if (entry->d_name[name_len - 4] == '.') {
-                size_t first = name_len - 3;
-                size_t second = name_len - 2;
-                size_t third = name_len - 1;
-        
-                int svgs = entry->d_name[first] == 's';
-                int svgv = entry->d_name[second] == 'v';
-                int svgg = entry->d_name[third] == 'g';
-                int svgsvg = svgs + svgv + svgg;
-        
-                if (svgsvg == 3) {
-                    Option option = {};
-                    option.parentIndexAndExtension = (current_parent_index & 0x3FFF) | (0 << 14);
-                    option.themeIndex = current_theme_index;
-                    entry->d_name[name_len - 4] = '\0';
-                    (&data->options[entry->d_name])->push_back(option);
-                    continue;
-                }
-        
-                int pngp = entry->d_name[first] == 'p';
-                int pngv = entry->d_name[second] == 'n';
-                int pngg = entry->d_name[third] == 'g';
-                int pngpng = pngg + pngv + pngp;
-        
-                if (pngpng == 3) {
-                    Option option = {};
-                    option.parentIndexAndExtension = (current_parent_index & 0x3FFF) | (1 << 14);
-                    option.themeIndex = current_theme_index;
-                    entry->d_name[name_len - 4] = '\0';
-                    (&data->options[entry->d_name])->push_back(option);
-                    continue;
-                }
-            }
+        int extension = icon_extension(entry->d_name, name_len);
+        if (extension != -1) {
+            scanned.icons.emplace_back(std::string(entry->d_name, name_len - 4), extension);
+            continue;
         }
         if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
             continue;
-    
-        char file[PATH_MAX];
-        snprintf(file, PATH_MAX, "%s/%s", path, entry->d_name);
-        if (stat(file, &entryStat) == -1)
-            continue;
-        if (S_ISDIR(entryStat.st_mode)) {
-            traverse_dir(file);
-        } else if (S_ISLNK(entryStat.st_mode)) {
-            char link[PATH_MAX];
-            ssize_t len = readlink(file, link, sizeof(link));
-            if (len != -1) {
-                link[len] = '\0';
-                traverse_dir(link);
-            }
+        
+        // Only links (and file systems that don't fill in d_type) need a stat to know if they are a folder
+        bool is_directory = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) {
+            struct stat entry_stat{};
+            if (fstatat(fd, entry->d_name, &entry_stat, 0) == 0)
+                is_directory = S_ISDIR(entry_stat.st_mode);
+        }
+        if (is_directory && queue->recursive) {
+            PendingDirectory subdirectory;
+            subdirectory.path = path + "/" + entry->d_name;
+            subdirectory.theme = is_search_path ? entry->d_name : theme;
+            subdirectory.ancestors = pending.ancestors;
+            subdirectory.ancestors.push_back(id);
+            subdirectories.push_back(std::move(subdirectory));
         }
     }
     closedir(dir);
+    
+    if (queue->recursive && !subdirectories.empty()) {
+        {
+            std::lock_guard lock(queue->mutex);
+            for (auto &subdirectory: subdirectories)
+                queue->pending.push_back(std::move(subdirectory));
+        }
+        queue->condition.notify_all();
+    }
+    if (!scanned.icons.empty()) {
+        scanned.path = path;
+        scanned.theme = theme;
+        results->push_back(std::move(scanned));
+    }
 }
 
-
-void generate_data() {
+// Reads the given folders (path, theme) and, if recursive, every folder under them on a few threads (each one pulling
+// the next folder off a shared queue). A search path is passed with itself as the theme.
+static std::vector<ScannedDirectory> traverse_dirs(const std::vector<std::pair<std::string, std::string>> &roots,
+                                                   bool recursive) {
 #ifdef TRACY_ENABLE
     ZoneScoped;
 #endif
+    DirectoryQueue queue;
+    queue.recursive = recursive;
+    for (const auto &root: roots)
+        queue.pending.push_back({root.first, root.second, {}});
+    
+    int thread_count = std::max(1, std::min(8, (int) std::thread::hardware_concurrency()));
+    std::vector<std::vector<ScannedDirectory>> results(thread_count);
+    auto worker = [&queue](std::vector<ScannedDirectory> *results) {
+        std::unique_lock lock(queue.mutex);
+        while (true) {
+            queue.condition.wait(lock, [&queue]() { return !queue.pending.empty() || queue.busy == 0; });
+            if (queue.pending.empty())
+                break;
+            PendingDirectory pending = std::move(queue.pending.front());
+            queue.pending.pop_front();
+            queue.busy++;
+            lock.unlock();
+            scan_directory(&queue, pending, results);
+            lock.lock();
+            queue.busy--;
+            if (queue.busy == 0 && queue.pending.empty())
+                queue.condition.notify_all();
+        }
+    };
+    
+    std::vector<std::thread> threads;
+    for (int i = 1; i < thread_count; i++)
+        threads.emplace_back(worker, &results[i]);
+    worker(&results[0]);
+    for (auto &thread: threads)
+        thread.join();
+    
+    std::vector<ScannedDirectory> merged;
+    for (auto &result: results)
+        for (auto &scanned: result)
+            merged.push_back(std::move(scanned));
+    // So the cache comes out the same no matter which thread got to which folder first
+    std::sort(merged.begin(), merged.end(), [](const ScannedDirectory &a, const ScannedDirectory &b) {
+        return a.path < b.path;
+    });
+    return merged;
+}
+
+static void clear_data() {
     for (auto item: data->options)
         item.second.clear();
     data->options.clear();
     data->parentPaths.clear();
     data->themes.clear();
+}
+
+static void add_scanned_directory(const ScannedDirectory &scanned) {
+    unsigned short int current_theme_index = data->themeIndexOf(scanned.theme);
+    data->parentPaths.push_back(scanned.path);
+    unsigned short int current_parent_index = data->parentPaths.size() - 1;
+    for (const auto &[name, extension]: scanned.icons) {
+        Option option = {};
+        option.parentIndexAndExtension = (current_parent_index & 0x3FFF) | (extension << 14);
+        option.themeIndex = current_theme_index;
+        data->options[name].push_back(option);
+    }
+}
+
+void generate_data() {
+#ifdef TRACY_ENABLE
+    ZoneScoped;
+#endif
+    clear_data();
     
-    const std::filesystem::directory_options searchOptions = (
-            std::filesystem::directory_options::follow_directory_symlink |
-            std::filesystem::directory_options::skip_permission_denied
-    );
-    struct stat st{};
-    for (const auto &search_path: icon_search_paths) {
-        if (stat(search_path.c_str(), &st) != 0)
-            continue;
+    std::vector<std::pair<std::string, std::string>> roots;
+    for (const auto &search_path: icon_search_paths)
+        roots.emplace_back(search_path, search_path);
+    for (const auto &scanned: traverse_dirs(roots, true))
+        add_scanned_directory(scanned);
+}
+
+// The icon 'context' based on the folder the icon is in (the last one found in the path wins)
+static IconContext parse_context(const std::string &parent_path) {
+    struct ICMap {
+        const char *name;
+        IconContext context;
+    };
+    static const ICMap ics[] = {{"/actions",    IconContext::Actions},
+                                {"/animations", IconContext::Animations},
+                                {"/apps",       IconContext::Apps},
+                                {"/categories", IconContext::Categories},
+                                {"/devices",    IconContext::Devices},
+                                {"/emblems",    IconContext::Emblems},
+                                {"/emotes",     IconContext::Emotes},
+                                {"/intl",       IconContext::Intl},
+                                {"/mimetypes",  IconContext::Mimetypes},
+                                {"/places",     IconContext::Places},
+                                {"/status",     IconContext::Statuses},
+                                {"/panel",      IconContext::Panel}};
+    std::string path_copy = parent_path;
+    for (char &t: path_copy)
+        t = std::tolower(t);
+    IconContext context = IconContext::NotSet;
+    for (const auto &item: ics)
+        if (path_copy.find(item.name) != std::string::npos)
+            context = item.context;
+    return context;
+}
+
+// The size and scale of the icons in a folder based on the part of the path after the theme (like "48x48@2/apps")
+static void parse_directory(const std::string &parent_path, const std::string &theme, int *size_out, int *scale_out) {
+    unsigned long startIndex = parent_path.find(theme);
+    if (startIndex == std::string::npos)
+        startIndex = 0;
+    startIndex += theme.size() + 1;
+    
+    char buffer[64];
+    int buffer_len = 0;
+    bool found_at = false;
+    int scale = 0;
+    int size = 0;
     
-        traverse_dir(search_path.data());
+    // Iterate through the characters in the path string
+    for (int i = startIndex; i < parent_path.length(); i++) {
+        if (scale != 0 && size != 0)
+            break;
+        
+        char c = parent_path[i];
+        if (isdigit(c)) {
+            // Save the digit character to the buffer
+            if (buffer_len < sizeof(buffer) - 1)
+                buffer[buffer_len++] = c;
+        } else if (c == '@') {
+            if (buffer_len != 0) {
+                buffer[buffer_len] = '\0';
+                size = atoi(buffer);
+            }
+            found_at = true;
+            buffer_len = 0;
+        } else if (c == '/' || c == 'x' || c == 'X' || i == parent_path.length() - 1) {
+            if (found_at && buffer_len != 0) {
+                // Convert the buffer to an integer and save it to the scale variable
+                buffer[buffer_len] = '\0';
+                scale = atoi(buffer);
+            } else if (buffer_len != 0) {
+                // Convert the buffer to an integer and save it to the size variable
+                buffer[buffer_len] = '\0';
+                size = atoi(buffer);
+            }
+            // Reset the buffer and the found_at flag
+            buffer_len = 0;
+            found_at = false;
+        }
     }
+    if (found_at && buffer_len != 0) {
+        // Convert the buffer to an integer and save it to the scale variable
+        buffer[buffer_len] = '\0';
+        scale = atoi(buffer);
+    } else if (buffer_len != 0) {
+        // Convert the buffer to an integer and save it to the size variable
+        buffer[buffer_len] = '\0';
+        size = atoi(buffer);
+    }
+    *size_out = size;
+    *scale_out = scale;
 }
 
 //
@@ -240,194 +579,253 @@ void save_data() {
             return;
     }
     
-    // version (string)
-    cache_file << std::to_string(cache_version) << '\0';
-
-#define WRITE_NUM(num) \
-    reinterpret_cast<const char *>(&num), sizeof(num) \
-
-    // We will use this number when loading, so we can pre-allocate a buffer that will contain every option name
-    // We won't need to zero terminate the strings in the buffer since we're going make a string view of the names
-    // when we load them.
-    unsigned long option_names_buffer_size = 0;
-    for (const auto &item: data->options)
-        option_names_buffer_size += item.first.size();
-    cache_file.write(WRITE_NUM(option_names_buffer_size));
-
-    // We will use this number to pre-allocate a buffer which will store the parentIndexAndExtension and,
-    // themeIndex contiguously. We'll access the data via a hash_table (std::unordered_map) which will take
-    // a string view and return a Range{int index, int count}, into the pre-allocated buffer.
-    unsigned long option_data_buffer_size = 0;
+    std::string strings;
+    auto add_string = [&strings](const std::string &string) {
+        IconCacheString result = {(uint32_t) strings.size(), (uint32_t) string.size()};
+        strings.append(string);
+        strings.push_back('\0');
+        return result;
+    };
+    
+    // Every option found in a folder has the theme of that folder
+    std::vector<IconCacheDirectory> directories(data->parentPaths.size());
     for (const auto &item: data->options)
-        option_data_buffer_size +=
-                item.second.size() * (sizeof(Option::parentIndexAndExtension) + sizeof(Option::themeIndex));
-    cache_file.write(WRITE_NUM(option_data_buffer_size));
-
-    // parent paths size (int)
-    cache_file << std::to_string(data->parentPaths.size()) << '\0';
-    for (const auto &item: data->parentPaths) {
-        // parent paths (string)
-        cache_file << item << '\0';
+        for (const auto &option: item.second)
+            directories[getParentIndex(option.parentIndexAndExtension)].theme = option.themeIndex;
+    for (int i = 0; i < data->parentPaths.size(); i++) {
+        auto directory = &directories[i];
+        directory->path = add_string(data->parentPaths[i]);
+        int size = 0;
+        int scale = 0;
+        parse_directory(data->parentPaths[i], data->themes[directory->theme], &size, &scale);
+        directory->size = size;
+        directory->scale = scale;
+        directory->context = parse_context(data->parentPaths[i]);
+        directory->unused = 0;
     }
     
-    // themes paths size (int)
-    cache_file << std::to_string(data->themes.size()) << '\0';
-    for (const auto &item: data->themes) {
-        // parent paths (string)
-        cache_file << item << '\0';
-    }
-
-    // options size (int)
-    cache_file << std::to_string(data->options.size()) << '\0';
+    std::vector<IconCacheString> themes;
+    for (const auto &theme: data->themes)
+        themes.push_back(add_string(theme));
+    
+    // std::map is already sorted the same way find_name compares
+    std::vector<IconCacheName> names;
+    std::vector<IconCacheOption> options;
+    names.reserve(data->options.size());
     for (const auto &item: data->options) {
-        // option name (string)
-        cache_file << item.first << '\0';
-        
-        // option size (unsigned short int)
-        unsigned short int optionsVectorSize = item.second.size();
-        cache_file.write(WRITE_NUM(optionsVectorSize));
-        
+        IconCacheName name = {add_string(item.first), (uint32_t) options.size(), (uint32_t) item.second.size()};
+        names.push_back(name);
         for (const auto &option: item.second) {
-            // (unsigned short int)
-            cache_file.write(WRITE_NUM(option.parentIndexAndExtension));
-//            cache_file << std::to_string(option.parentIndexAndExtension) << '\0';
-            // (char)
-            cache_file.write(WRITE_NUM(option.themeIndex));
-//            cache_file << std::to_string(option.themeIndex) << '\0';
+            IconCacheOption cache_option = {};
+            cache_option.directory = getParentIndex(option.parentIndexAndExtension);
+            cache_option.extension = getExtension(option.parentIndexAndExtension);
+            options.push_back(cache_option);
         }
     }
     
+    // Substring search in get_options intersects these instead of looking at every name
+    std::vector<std::pair<uint32_t, uint32_t>> name_trigrams;
+    for (uint32_t i = 0; i < names.size(); i++) {
+        std::string_view name(strings.data() + names[i].name.offset, names[i].name.length);
+        for (size_t j = 0; j + 3 <= name.size(); j++)
+            name_trigrams.emplace_back(pack_trigram(name.data() + j), i);
+    }
+    std::sort(name_trigrams.begin(), name_trigrams.end());
+    name_trigrams.erase(std::unique(name_trigrams.begin(), name_trigrams.end()), name_trigrams.end());
+    std::vector<IconCacheTrigram> trigrams;
+    std::vector<uint32_t> postings;
+    postings.reserve(name_trigrams.size());
+    for (const auto &[trigram, name]: name_trigrams) {
+        if (trigrams.empty() || trigrams.back().trigram != trigram)
+            trigrams.push_back({trigram, (uint32_t) postings.size(), 0, 0});
+        trigrams.back().posting_count++;
+        postings.push_back(name);
+    }
+    
+    auto align = [](uint64_t offset) { return (offset + 7) & ~((uint64_t) 7); };
+    IconCacheHeader header = {};
+    header.name_count = names.size();
+    header.option_count = options.size();
+    header.directory_count = directories.size();
+    header.theme_count = themes.size();
+    header.trigram_count = trigrams.size();
+    header.posting_count = postings.size();
+    header.names_offset = align(8 + sizeof(IconCacheHeader));
+    header.options_offset = align(header.names_offset + names.size() * sizeof(IconCacheName));
+    header.directories_offset = align(header.options_offset + options.size() * sizeof(IconCacheOption));
+    header.themes_offset = align(header.directories_offset + directories.size() * sizeof(IconCacheDirectory));
+    header.trigrams_offset = align(header.themes_offset + themes.size() * sizeof(IconCacheString));
+    header.postings_offset = align(header.trigrams_offset + trigrams.size() * sizeof(IconCacheTrigram));
+    header.strings_offset = align(header.postings_offset + postings.size() * sizeof(uint32_t));
+    header.strings_size = strings.size();
+    header.file_size = header.strings_offset + strings.size();
+    
+    uint64_t written = 0;
+    auto write_section = [&cache_file, &written](uint64_t offset, const void *section, size_t size) {
+        static const char padding[8] = {};
+        cache_file.write(padding, offset - written);
+        cache_file.write(reinterpret_cast<const char *>(section), size);
+        written = offset + size;
+    };
+    
+    std::string version = std::to_string(cache_version);
+    write_section(0, version.data(), version.size());
+    write_section(8, &header, sizeof(header));
+    write_section(header.names_offset, names.data(), names.size() * sizeof(IconCacheName));
+    write_section(header.options_offset, options.data(), options.size() * sizeof(IconCacheOption));
+    write_section(header.directories_offset, directories.data(), directories.size() * sizeof(IconCacheDirectory));
+    write_section(header.themes_offset, themes.data(), themes.size() * sizeof(IconCacheString));
+    write_section(header.trigrams_offset, trigrams.data(), trigrams.size() * sizeof(IconCacheTrigram));
+    write_section(header.postings_offset, postings.data(), postings.size() * sizeof(uint32_t));
+    write_section(header.strings_offset, strings.data(), strings.size());
+    
+    if (!cache_file) {
+        cache_file.close();
+        unlink(icon_cache_temp_path.data());
+        return;
+    }
     cache_file.close();
     rename(icon_cache_temp_path.data(), icon_cache_path.data());
 }
 
-static bool first_time_load_data = true;
+// Makes sure every section is inside the file, and every index and string in them points inside their section, before
+// anything points into it
+static bool view_icon_cache(char *icon_cache_data, size_t file_size, IconCacheView *view) {
+    if (file_size < 8 + sizeof(IconCacheHeader))
+        return false;
+    auto header = reinterpret_cast<const IconCacheHeader *>(icon_cache_data + 8);
+    auto section_fits = [header](uint64_t offset, uint64_t count, uint64_t size) {
+        return offset % 8 == 0 && offset <= header->file_size && count <= (header->file_size - offset) / size;
+    };
+    if (header->file_size != file_size ||
+        !section_fits(header->names_offset, header->name_count, sizeof(IconCacheName)) ||
+        !section_fits(header->options_offset, header->option_count, sizeof(IconCacheOption)) ||
+        !section_fits(header->directories_offset, header->directory_count, sizeof(IconCacheDirectory)) ||
+        !section_fits(header->themes_offset, header->theme_count, sizeof(IconCacheString)) ||
+        !section_fits(header->trigrams_offset, header->trigram_count, sizeof(IconCacheTrigram)) ||
+        !section_fits(header->postings_offset, header->posting_count, sizeof(uint32_t)) ||
+        !section_fits(header->strings_offset, header->strings_size, 1))
+        return false;
+    auto names = reinterpret_cast<const IconCacheName *>(icon_cache_data + header->names_offset);
+    auto options = reinterpret_cast<const IconCacheOption *>(icon_cache_data + header->options_offset);
+    auto directories = reinterpret_cast<const IconCacheDirectory *>(icon_cache_data + header->directories_offset);
+    auto themes = reinterpret_cast<const IconCacheString *>(icon_cache_data + header->themes_offset);
+    auto trigrams = reinterpret_cast<const IconCacheTrigram *>(icon_cache_data + header->trigrams_offset);
+    auto postings = reinterpret_cast<const uint32_t *>(icon_cache_data + header->postings_offset);
+    
+    auto string_fits = [header](const IconCacheString &string) {
+        return string.offset <= header->strings_size && string.length <= header->strings_size - string.offset;
+    };
+    for (uint32_t i = 0; i < header->name_count; i++)
+        if (!string_fits(names[i].name) || names[i].first_option > header->option_count ||
+            names[i].option_count > header->option_count - names[i].first_option)
+            return false;
+    for (uint32_t i = 0; i < header->option_count; i++)
+        if (options[i].directory >= header->directory_count)
+            return false;
+    for (uint32_t i = 0; i < header->directory_count; i++)
+        if (!string_fits(directories[i].path) || directories[i].theme >= header->theme_count)
+            return false;
+    for (uint32_t i = 0; i < header->theme_count; i++)
+        if (!string_fits(themes[i]))
+            return false;
+    for (uint32_t i = 0; i < header->trigram_count; i++)
+        if (trigrams[i].first_posting > header->posting_count ||
+            trigrams[i].posting_count > header->posting_count - trigrams[i].first_posting)
+            return false;
+    for (uint32_t i = 0; i < header->posting_count; i++)
+        if (postings[i] >= header->name_count)
+            return false;
+    
+    view->header = header;
+    view->names = names;
+    view->options = options;
+    view->directories = directories;
+    view->themes = themes;
+    view->trigrams = trigrams;
+    view->postings = postings;
+    view->strings = icon_cache_data + header->strings_offset;
+    return true;
+}
 
-void load_data() {
-#ifdef TRACY_ENABLE
-    ZoneScoped;
-#endif
-    for (auto item: data->options)
-        item.second.clear();
-    data->options.clear();
-    data->parentPaths.clear();
-    data->themes.clear();
-    if (name_buffer != nullptr)
-        delete[] name_buffer;
-    if (option_buffer != nullptr)
-        delete[] option_buffer;
-    ranges.clear();
+static bool first_time_load_data = true;
 
-    // Load data from disk
+static void load_data_locked() {
     const char *home_directory = getenv("HOME");
     std::string icon_cache_path(home_directory);
     icon_cache_path += "/.cache/winbar_icon_cache/icon.cache";
-
+    
+    int fd = open(icon_cache_path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        unmap_cache();
+        return;
+    }
     struct stat cache_stat{};
-    if (stat(icon_cache_path.c_str(), &cache_stat) == 0) { // exists
-        // Open the file
-        int fd = open(icon_cache_path.c_str(), O_RDONLY);
-        if (fd == -1) {
-            fprintf(stderr, "Error opening file");
-            return;
-        }
-
-        off_t fileSize = cache_stat.st_size;
-
-        // Map the file into memory
-        char *icon_cache_data = (char *) mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
-        if (icon_cache_data == MAP_FAILED) {
-            fprintf(stderr, "Error mapping file");
-            close(fd);
-            return;
-        }
-
-        std::string versionString = std::string(icon_cache_data);
-        int version = atoi(versionString.data());
-        if (version < cache_version) {
-            if (first_time_load_data) {
-                munmap(icon_cache_data, fileSize);
-                close(fd);
-                first_time_load_data = false;
-                generate_data();
-                save_data();
-                load_data();
-                first_time_load_data = true;
-            }
-            return;
-        }
-
-        unsigned long index_into_file = 0;
-        char buffer[PATH_MAX * 2];
-        size_t max = sizeof(buffer) - 1;
-        long len;
-
-#define READ_STRING(tess) \
-        strncpy(buffer, icon_cache_data + index_into_file, max); \
-        buffer[max] = '\0'; \
-        len = strlen(buffer); \
-        index_into_file += len + 1; \
-        std::string tess = std::string(buffer, std::max(len, (long) 0));
-
-#define READ_NUM(tem) \
-    *reinterpret_cast<tem *>((icon_cache_data + index_into_file)); \
-    index_into_file += sizeof(tem)
-        
-        // Version
-        READ_STRING(version_number)
-
-        unsigned long size_of_pre_allocated_string_buffer = READ_NUM(unsigned long);
-        name_buffer = new char[size_of_pre_allocated_string_buffer];
-        unsigned long size_of_pre_allocated_options_buffer = READ_NUM(unsigned long);
-        option_buffer = new char[size_of_pre_allocated_options_buffer];
-
-        READ_STRING(amountOfParentsString)
-        int amountOfParents = std::stoi(amountOfParentsString);
-        for (int i = 0; i < amountOfParents; ++i) {
-            READ_STRING(parentPath)
-            data->parentPaths.push_back(std::move(parentPath));
-        }
-        
-        READ_STRING(amountOfThemesString)
-        int amountOfThemes = std::stoi(amountOfThemesString);
-        for (int i = 0; i < amountOfThemes; ++i) {
-            READ_STRING(theme)
-            data->themes.push_back(std::move(theme));
-        }
-        
-        READ_STRING(optionsSizeString)
-        int optionsSize = std::stoi(optionsSizeString);
-
-        ranges.reserve(optionsSize);
-        unsigned long names_buffer_index = 0;
-        unsigned long option_data_index = 0;
-        for (int i = 0; i < optionsSize; ++i) {
-            strncpy(buffer, icon_cache_data + index_into_file, max);
-            buffer[max] = '\0';
-            len = strlen(buffer);
-            strncpy(name_buffer + names_buffer_index, icon_cache_data + index_into_file, len);
-            index_into_file += len + 1;
-            std::string name = std::string(buffer, std::max(len, (long) 0));
-
-            auto optionSize = READ_NUM(unsigned short int);
-            auto view = std::string_view(name_buffer + names_buffer_index, len);
-            names_buffer_index += len;
-            ranges[view] = {option_data_index, (unsigned long) optionSize * 3};
-
-            for (int j = 0; j < optionSize; ++j) {
-                std::memcpy(option_buffer + option_data_index, icon_cache_data + index_into_file,
-                            sizeof(unsigned short int));
-                std::memcpy(option_buffer + option_data_index + sizeof(unsigned short int),
-                            icon_cache_data + index_into_file + sizeof(unsigned short int),
-                            sizeof(unsigned char));
-                index_into_file += sizeof(unsigned short int) + sizeof(unsigned char);
-                option_data_index += sizeof(unsigned short int) + sizeof(unsigned char);
-            }
-        }
-
-        munmap(icon_cache_data, fileSize);
+    if (fstat(fd, &cache_stat) != 0 || cache_stat.st_size < 8 + (off_t) sizeof(IconCacheHeader)) {
         close(fd);
+        unmap_cache();
+        return;
+    }
+    auto mapped = current_cache();
+    if (mapped && cache_stat.st_ino == mapped->inode && cache_stat.st_mtim.tv_sec == mapped->mtime.tv_sec &&
+        cache_stat.st_mtim.tv_nsec == mapped->mtime.tv_nsec) {
+        close(fd);
+        return;
     }
+    mapped = nullptr;
+    unmap_cache();
+    
+    size_t file_size = cache_stat.st_size;
+    // save_data renames a new file over this one instead of writing into it, so the mapped inode never changes under
+    // the candidates still holding this mapping
+    auto icon_cache_data = (char *) mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (icon_cache_data == MAP_FAILED) {
+        fprintf(stderr, "Error mapping file");
+        return;
+    }
+    
+    int version = atoi(std::string(icon_cache_data, strnlen(icon_cache_data, 8)).data());
+    if (version < cache_version) {
+        munmap(icon_cache_data, file_size);
+        if (first_time_load_data) {
+            first_time_load_data = false;
+            generate_data();
+            save_data();
+            load_data_locked();
+            first_time_load_data = true;
+        }
+        return;
+    }
+    
+    IconCacheView view;
+    if (version != cache_version || !view_icon_cache(icon_cache_data, file_size, &view)) {
+        munmap(icon_cache_data, file_size);
+        return;
+    }
+    
+    auto mapping = std::make_shared<IconCacheMapping>();
+    mapping->data = icon_cache_data;
+    mapping->size = file_size;
+    mapping->view = view;
+    mapping->inode = cache_stat.st_ino;
+    mapping->mtime = cache_stat.st_mtim;
+    std::lock_guard lock(cache_mutex);
+    cache = std::move(mapping);
+}
+
+void load_data() {
+#ifdef TRACY_ENABLE
+    ZoneScoped;
+#endif
+    // Holders of icon_cache_mutex are rewriting icon.cache, so a mapping that's already there is kept until the next
+    // check instead of being swapped mid rebuild. Waiting for them would deadlock: update_icon_cache holds it while it
+    // waits for app->running_mutex, which the main thread holds whenever it searches icons.
+    std::unique_lock rebuilding(icon_cache_mutex, std::try_to_lock);
+    if (!rebuilding.owns_lock() && current_cache())
+        return;
+    std::lock_guard lock(load_data_mutex);
+    load_data_locked();
 }
 
 void update_paths() {
@@ -475,6 +873,8 @@ void check_if_cache_needs_update(App *, AppClient *, Timeout *timeout, void *);
 
 void check_cache_file();
 
+static void watch_icon_folders(App *app);
+
 void set_icons_path_and_possibly_update(App *app) {
 #ifdef TRACY_ENABLE
     ZoneScoped;
@@ -483,9 +883,11 @@ void set_icons_path_and_possibly_update(App *app) {
     if (data == nullptr)
         data = new OptionsData();
     update_paths();
+    // Catches changes made while winbar wasn't running (the ones made while it is are seen by watch_icon_folders)
     app_timeout_create(app, nullptr, 50000, check_if_cache_needs_update, nullptr, const_cast<char *>(__PRETTY_FUNCTION__));
     
     check_cache_file();
+    watch_icon_folders(app);
 }
 
 static std::string first_message;
@@ -527,6 +929,7 @@ void check_cache_file() {
 #ifdef TRACY_ENABLE
     ZoneScoped;
 #endif
+    std::lock_guard lock(check_cache_file_mutex);
     if (get_current_time_in_ms() - last_time_cached_checked < 5000) {
         // If it hasn't been five seconds since last time checked
         return;
@@ -621,9 +1024,11 @@ void search_icons(std::vector<IconTarget> &targets) {
     ZoneScoped;
 #endif
     check_cache_file();
+    auto mapping = current_cache();
+    IconCacheView view = mapping ? mapping->view : IconCacheView();
     
     for (int i = 0; i < targets.size(); ++i) {
-        auto target = targets[i];
+        auto &target = targets[i];
         
         std::string_view target_name = target.name.c_str();
         if (target.name.size() > 2 && target.name[0] == ':' && target.name.find(':', 1) != std::string::npos) {
@@ -631,147 +1036,55 @@ void search_icons(std::vector<IconTarget> &targets) {
             target_name = std::string_view(target.name.data() + start + 1, target.name.size() - start - 1);
         }
         
-        if (ranges.find(target_name) == ranges.end()) {
+        auto name = find_name(view, target_name);
+        if (!name) {
             // Could be a path
             if (!target_name.empty() && target_name[0] == '/') {
-                Candidate candidate;
-                
-                // Extract parent path
-                size_t last_slash = target_name.find_last_of("/");
-                if (last_slash != std::string::npos) {
-                    candidate.parent_path = target_name.substr(0, last_slash);
+                size_t last_slash = target_name.find_last_of('/');
+                size_t last_dot = target_name.find_last_of('.');
+                if (last_dot != std::string::npos) {
+                    Candidate candidate;
+                    candidate.path = target_name;
                     
-                    // Extract filename
-                    size_t last_dot = target_name.find_last_of(".");
-                    if (last_dot != std::string::npos) {
-                        candidate.filename = target_name.substr(last_slash + 1, last_dot - last_slash - 1);
-                        
-                        // Determine extension
-                        std::string extension_str = std::string(target_name.substr(last_dot));
-                        std::transform(extension_str.begin(), extension_str.end(), extension_str.begin(), ::tolower);
-                        if (extension_str == ".png") {
-                            candidate.extension = 1;
-                        } else if (extension_str == ".svg") {
-                            candidate.extension = 0;
-                        } else if (extension_str == ".xpm") {
-                            candidate.extension = 2;
-                        } else {
-                            candidate.extension = 1; // Unknown extension
-                        }
-                        
-                        // Set default values for other fields
-                        candidate.theme = "hardcoded";
-                        candidate.size = 48; // Default size
-                        candidate.scale = 1; // Default scale
-                        candidate.context = IconContext::Apps;
-                        
-                        targets[i].candidates.push_back(candidate);
+                    // Determine extension
+                    std::string extension_str = std::string(target_name.substr(last_dot));
+                    std::transform(extension_str.begin(), extension_str.end(), extension_str.begin(), ::tolower);
+                    if (extension_str == ".png") {
+                        candidate.extension = 1;
+                    } else if (extension_str == ".svg") {
+                        candidate.extension = 0;
+                    } else if (extension_str == ".xpm") {
+                        candidate.extension = 2;
+                    } else {
+                        candidate.extension = 1; // Unknown extension
                     }
+                    
+                    // Set default values for other fields
+                    candidate.size = 48; // Default size
+                    candidate.scale = 1; // Default scale
+                    candidate.context = IconContext::Apps;
+                    
+                    target.candidates.push_back(std::move(candidate));
                 }
             }
             
             continue;
         }
-        Range range = ranges[target_name];
-
-        std::vector<Candidate> candidates;
-        for (int j = 0; j < (range.length / 3); ++j) {
-            unsigned long actual_index = range.start + j * 3;
-            unsigned short int parentIndexAndExtension = 0;
-            std::memcpy(&parentIndexAndExtension, option_buffer + actual_index, sizeof(unsigned short int));
-            unsigned char themeIndex = 0;
-            std::memcpy(&themeIndex, option_buffer + actual_index + sizeof(unsigned short int), sizeof(unsigned char));
-
-            Candidate candidate;
-            candidate.parent_path = data->parentPaths[getParentIndex(parentIndexAndExtension)];
-            candidate.filename = target_name;
-            candidate.theme = data->themes[themeIndex];
-            candidate.extension = getExtension(parentIndexAndExtension);
-            candidate.context = IconContext::NotSet;
-            // The following is to set the icon 'context' based on the parent_path
-            struct ICMap {
-                std::string name;
-                IconContext context;
-            };
-            std::vector<ICMap> ics = {{"/actions",    IconContext::Actions},
-                                      {"/animations", IconContext::Animations},
-                                      {"/apps",       IconContext::Apps},
-                                      {"/categories", IconContext::Categories},
-                                      {"/devices",    IconContext::Devices},
-                                      {"/emblems",    IconContext::Emblems},
-                                      {"/emotes",     IconContext::Emotes},
-                                      {"/intl",       IconContext::Intl},
-                                      {"/mimetypes",  IconContext::Mimetypes},
-                                      {"/places",     IconContext::Places},
-                                      {"/status",     IconContext::Statuses},
-                                      {"/panel",      IconContext::Panel}};
-            std::string path_copy = candidate.parent_path;
-            for (char &t: path_copy)
-                t = std::tolower(t);
-            for (const auto &item: ics)
-                if (path_copy.find(item.name) != std::string::npos)
-                    candidate.context = item.context;
-
-            // The following is to determine the size and scale of the icon based on the parent path
-            unsigned long startIndex = candidate.parent_path.find(candidate.theme);
-            if (startIndex == std::string::npos)
-                startIndex = 0;
-            startIndex += candidate.theme.size() + 1;
-            
-            char buffer[64];
-            int buffer_len = 0;
-            bool found_at = false;
-            int scale = 0;
-            int size = 0;
+        target.candidates.reserve(target.candidates.size() + name->option_count);
+        for (uint32_t j = 0; j < name->option_count; ++j) {
+            const IconCacheOption &option = view.options[name->first_option + j];
+            const IconCacheDirectory &directory = view.directories[option.directory];
             
-            // Iterate through the characters in the path string
-            for (int i = startIndex; i < candidate.parent_path.length(); i++) {
-                if (scale != 0 && size != 0)
-                    break;
-                
-                char c = candidate.parent_path[i];
-                if (isdigit(c)) {
-                    // Save the digit character to the buffer
-                    buffer[buffer_len] = c;
-                    buffer_len++;
-                } else if (c == '@') {
-                    if (buffer_len != 0) {
-                        buffer[buffer_len] = '\0';
-                        size = atoi(buffer);
-                    }
-                    found_at = true;
-                    buffer_len = 0;
-                } else if (c == '/' || c == 'x' || c == 'X' || i == candidate.parent_path.length() - 1) {
-                    if (found_at && buffer_len != 0) {
-                        // Convert the buffer to an integer and save it to the scale variable
-                        buffer[buffer_len] = '\0';
-                        scale = atoi(buffer);
-                    } else if (buffer_len != 0) {
-                        // Convert the buffer to an integer and save it to the size variable
-                        buffer[buffer_len] = '\0';
-                        size = atoi(buffer);
-                    }
-                    // Reset the buffer and the found_at flag
-                    buffer_len = 0;
-                    found_at = false;
-                }
-            }
-            if (found_at && buffer_len != 0) {
-                // Convert the buffer to an integer and save it to the scale variable
-                buffer[buffer_len] = '\0';
-                scale = atoi(buffer);
-            } else if (buffer_len != 0) {
-                // Convert the buffer to an integer and save it to the size variable
-                buffer[buffer_len] = '\0';
-                size = atoi(buffer);
-            }
-            candidate.size = size;
-            candidate.scale = scale;
-            candidates.push_back(candidate);
+            Candidate candidate;
+            candidate.mapping = mapping;
+            candidate.directory = option.directory;
+            candidate.name = name - view.names;
+            candidate.extension = option.extension;
+            candidate.size = directory.size;
+            candidate.scale = directory.scale;
+            candidate.context = (IconContext) directory.context;
+            target.candidates.push_back(std::move(candidate));
         }
-        
-        for (const auto &item: candidates)
-            targets[i].candidates.push_back(item);
     }
 }
 
@@ -908,10 +1221,10 @@ void pick_best(std::vector<IconTarget> &targets, int target_size, IconContext ta
         } else {
             for (int i = 0; i < target->candidates.size(); i++) {
                 Candidate *candidate = &target->candidates[i];
-                candidate->is_part_of_current_theme = current_theme == candidate->theme;
+                candidate->is_part_of_current_theme = current_theme == candidate->theme();
                 candidate->is_part_of_target_context = candidate->context == target_context;
                 if (has_preferred_theme) {
-                    candidate->is_part_of_preferred_theme = candidate->theme == preferred_theme;
+                    candidate->is_part_of_preferred_theme = candidate->theme() == preferred_theme;
                 }
                
                 if (candidate->context == IconContext::NotSet)
@@ -937,7 +1250,7 @@ void pick_best(std::vector<IconTarget> &targets, int target_size, IconContext ta
             // Sort vector based on quality and size, and current theme
             // Set best_full_path equal to best top option
             std::sort(target->candidates.begin(), target->candidates.end(),
-                      [current_theme](Candidate lhs, Candidate rhs) {
+                      [](const Candidate &lhs, const Candidate &rhs) {
                           if (lhs.is_part_of_preferred_theme == rhs.is_part_of_preferred_theme) {
                               if (lhs.is_part_of_current_theme == rhs.is_part_of_current_theme) {
                                   if (lhs.is_part_of_target_context == rhs.is_part_of_target_context) {
@@ -1027,10 +1340,283 @@ void check_if_cache_needs_update(App *app, AppClient *, Timeout *timeout, void *
     t.detach();
 }
 
+// Every folder in the icon cache as of the last time update_icon_cache read or wrote it (and which file that was, so
+// a cache regenerated by someone else in the meantime is noticed). Only touched with icon_cache_mutex held.
+static std::map<std::string, ScannedDirectory> scanned_folders;
+static ino_t scanned_folders_inode = 0;
+static struct timespec scanned_folders_mtime = {};
+
+static int icon_inotify_fd = -1;
+static std::mutex icon_watch_mutex;
+static std::unordered_map<int, std::string> watched_folders;
+static std::set<std::string> watched_paths;
+
+// Bumped by unload_icons, so an update_icon_cache started before an in-process restart doesn't run after it
+static int icons_generation = 0;
+
+// What changed since the last update_icon_cache (only touched on the main thread)
+static std::set<std::string> changed_folders; // The icons directly inside changed
+static std::set<std::string> changed_trees; // Folders were added or removed, so everything under it is read again
+static bool changed_everything = false;
+static Timeout *icon_update_timeout = nullptr;
+
+// The theme of a folder: the folder right inside the search path it is in, or the search path itself
+static std::string theme_of(const std::string &path) {
+    for (const auto &item: icon_search_paths) {
+        if (path.compare(0, item.size(), item) != 0)
+            continue;
+        if (path.size() == item.size())
+            return path;
+        if (path[item.size()] != '/')
+            continue;
+        std::string rest = path.substr(item.size() + 1);
+        return rest.substr(0, rest.find('/'));
+    }
+    return path;
+}
+
+static bool same_file(const char *path, ino_t inode, const struct timespec &mtime) {
+    struct stat file_stat{};
+    if (stat(path, &file_stat) != 0)
+        return false;
+    return file_stat.st_ino == inode && file_stat.st_mtim.tv_sec == mtime.tv_sec &&
+           file_stat.st_mtim.tv_nsec == mtime.tv_nsec;
+}
+
+// Fills scanned_folders back in from icon.cache instead of reading every folder again
+static bool load_scanned_folders() {
+#ifdef TRACY_ENABLE
+    ZoneScoped;
+#endif
+    scanned_folders.clear();
+    const char *home_directory = getenv("HOME");
+    std::string icon_cache_path(home_directory);
+    icon_cache_path += "/.cache/winbar_icon_cache/icon.cache";
+    
+    // A mapping of its own since the main thread can replace the one search_icons uses at any time
+    int fd = open(icon_cache_path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+    struct stat cache_stat{};
+    if (fstat(fd, &cache_stat) != 0 || cache_stat.st_size < 8 + (off_t) sizeof(IconCacheHeader)) {
+        close(fd);
+        return false;
+    }
+    size_t file_size = cache_stat.st_size;
+    auto icon_cache_data = (char *) mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (icon_cache_data == MAP_FAILED)
+        return false;
+    
+    IconCacheView view;
+    int version = atoi(std::string(icon_cache_data, strnlen(icon_cache_data, 8)).data());
+    if (version != cache_version || !view_icon_cache(icon_cache_data, file_size, &view)) {
+        munmap(icon_cache_data, file_size);
+        return false;
+    }
+    for (uint32_t i = 0; i < view.header->name_count; i++) {
+        const IconCacheName &name = view.names[i];
+        for (uint32_t j = 0; j < name.option_count; j++) {
+            const IconCacheOption &option = view.options[name.first_option + j];
+            const IconCacheDirectory &directory = view.directories[option.directory];
+            auto &scanned = scanned_folders[std::string(view.string(directory.path))];
+            if (scanned.path.empty()) {
+                scanned.path = view.string(directory.path);
+                scanned.theme = view.string(view.themes[directory.theme]);
+            }
+            scanned.icons.emplace_back(view.string(name.name), option.extension);
+        }
+    }
+    munmap(icon_cache_data, file_size);
+    scanned_folders_inode = cache_stat.st_ino;
+    scanned_folders_mtime = cache_stat.st_mtim;
+    return true;
+}
+
+static void watch_folder(const std::string &path) {
+    std::lock_guard lock(icon_watch_mutex);
+    if (icon_inotify_fd == -1 || watched_paths.count(path))
+        return;
+    // Only folders being added or removed matter (an icon being rewritten in place doesn't change the cache)
+    int wd = inotify_add_watch(icon_inotify_fd, path.c_str(),
+                               IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF |
+                               IN_ONLYDIR);
+    if (wd == -1)
+        return;
+    watched_folders[wd] = path;
+    watched_paths.insert(path);
+}
+
+// The search paths and the theme folders right inside them, which are watched even if they don't have icons themselves
+static void watch_search_paths() {
+    for (const auto &search_path: icon_search_paths) {
+        watch_folder(search_path);
+        DIR *dir = opendir(search_path.c_str());
+        if (dir == nullptr)
+            continue;
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+                continue;
+            if (entry->d_type == DT_DIR || entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN)
+                watch_folder(search_path + "/" + entry->d_name);
+        }
+        closedir(dir);
+    }
+}
+
+// Reads only the folders that changed and rewrites icon.cache (atomically, through save_data)
+static void update_icon_cache(App *app, int generation, bool everything, const std::set<std::string> &folders,
+                              const std::set<std::string> &trees) {
+#ifdef TRACY_ENABLE
+    ZoneScoped;
+#endif
+    std::lock_guard m(icon_cache_mutex);
+    // The icons were unloaded (and app possibly cleaned up) while this was waiting for the lock
+    if (data == nullptr || generation != icons_generation)
+        return;
+    const char *home_directory = getenv("HOME");
+    std::string icon_cache_path(home_directory);
+    icon_cache_path += "/.cache/winbar_icon_cache/icon.cache";
+    
+    std::vector<std::pair<std::string, std::string>> tree_roots;
+    std::vector<std::pair<std::string, std::string>> folder_roots;
+    if (everything || (!same_file(icon_cache_path.c_str(), scanned_folders_inode, scanned_folders_mtime) &&
+                       !load_scanned_folders())) {
+        scanned_folders.clear();
+        for (const auto &search_path: icon_search_paths)
+            tree_roots.emplace_back(search_path, search_path);
+    } else {
+        for (const auto &tree: trees) {
+            // Forget the folder and everything under it ("/" sorts right before "0")
+            scanned_folders.erase(tree);
+            scanned_folders.erase(scanned_folders.lower_bound(tree + "/"), scanned_folders.lower_bound(tree + "0"));
+            tree_roots.emplace_back(tree, theme_of(tree));
+        }
+        for (const auto &folder: folders) {
+            bool inside_tree = false;
+            for (const auto &tree: trees)
+                if (folder == tree || folder.compare(0, tree.size() + 1, tree + "/") == 0)
+                    inside_tree = true;
+            if (inside_tree)
+                continue;
+            scanned_folders.erase(folder);
+            folder_roots.emplace_back(folder, theme_of(folder));
+        }
+    }
+    
+    auto add_results = [](std::vector<ScannedDirectory> results) {
+        for (auto &scanned: results) {
+            watch_folder(scanned.path);
+            std::string path = scanned.path;
+            scanned_folders[path] = std::move(scanned);
+        }
+    };
+    add_results(traverse_dirs(tree_roots, true));
+    add_results(traverse_dirs(folder_roots, false));
+    watch_search_paths();
+    
+    std::lock_guard lock(app->running_mutex);
+    clear_data();
+    for (const auto &[path, scanned]: scanned_folders)
+        add_scanned_directory(scanned);
+    save_data();
+    
+    struct stat cache_stat{};
+    if (stat(icon_cache_path.c_str(), &cache_stat) == 0) {
+        scanned_folders_inode = cache_stat.st_ino;
+        scanned_folders_mtime = cache_stat.st_mtim;
+    }
+}
+
+static void icon_folders_settled(App *app, AppClient *, Timeout *, void *) {
+    icon_update_timeout = nullptr;
+    std::thread t(update_icon_cache, app, icons_generation, changed_everything, changed_folders, changed_trees);
+    t.detach();
+    changed_everything = false;
+    changed_folders.clear();
+    changed_trees.clear();
+}
+
+static void icon_folders_changed(App *app, int fd, void *) {
+    char buf[4096]
+            __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *event;
+    ssize_t len;
+    while ((len = read(fd, buf, sizeof(buf))) > 0) {
+        for (char *ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + event->len) {
+            event = (const struct inotify_event *) ptr;
+            if (event->mask & IN_Q_OVERFLOW) {
+                changed_everything = true;
+                continue;
+            }
+            
+            std::string path;
+            {
+                std::lock_guard lock(icon_watch_mutex);
+                auto found = watched_folders.find(event->wd);
+                if (found == watched_folders.end())
+                    continue;
+                path = found->second;
+                // The watch is gone (because the folder is)
+                if (event->mask & IN_IGNORED) {
+                    watched_paths.erase(path);
+                    watched_folders.erase(found);
+                }
+            }
+            
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                changed_trees.insert(path);
+            } else if (event->len) {
+                if (event->mask & IN_ISDIR) {
+                    changed_trees.insert(path + "/" + event->name);
+                } else if (icon_extension(event->name, strlen(event->name)) != -1) {
+                    changed_folders.insert(path);
+                } else if (strcmp(event->name, "icon-theme.cache") == 0 || strcmp(event->name, "index.theme") == 0) {
+                    // Installers run gtk-update-icon-cache after adding icons, which also catches new folders deeper
+                    // in the theme than the ones being watched
+                    changed_trees.insert(path);
+                }
+            }
+        }
+    }
+    
+    if (!changed_everything && changed_folders.empty() && changed_trees.empty())
+        return;
+    // Installing a package adds lots of files one after another, so wait for things to settle down first
+    if (icon_update_timeout == nullptr) {
+        icon_update_timeout = app_timeout_create(app, nullptr, 3000, icon_folders_settled, nullptr,
+                                                 const_cast<char *>(__PRETTY_FUNCTION__));
+    } else {
+        app_timeout_replace(app, nullptr, icon_update_timeout, 3000, icon_folders_settled, nullptr);
+    }
+}
+
+static void watch_icon_folders(App *app) {
+    if (icon_inotify_fd != -1)
+        return;
+    icon_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (icon_inotify_fd == -1)
+        return;
+    poll_descriptor(app, icon_inotify_fd, EPOLLIN, icon_folders_changed, nullptr, "Icon folder changes");
+    // Adding thousands of watches takes a moment, so it's done off the main thread
+    std::thread t([]() -> void {
+        std::lock_guard m(icon_cache_mutex);
+        watch_search_paths();
+        if (load_scanned_folders())
+            for (const auto &[path, scanned]: scanned_folders)
+                watch_folder(path);
+    });
+    t.detach();
+}
+
 void unload_icons() {
 #ifdef TRACY_ENABLE
     ZoneScoped;
 #endif
+    // Waits for update_icon_cache (and the other icon cache workers) to be done with data and icon_search_paths
+    std::lock_guard m(icon_cache_mutex);
+    icons_generation++;
     if (data != nullptr) {
         data->parentPaths.clear();
         data->parentPaths.shrink_to_fit();
@@ -1041,18 +1627,100 @@ void unload_icons() {
         data->options.clear();
         delete data;
         data = nullptr;
-        delete[] name_buffer;
-        delete[] option_buffer;
-        name_buffer = nullptr;
-        option_buffer = nullptr;
-        ranges.clear();
     }
+    unmap_cache();
+    {
+        std::lock_guard lock(icon_watch_mutex);
+        if (icon_inotify_fd != -1)
+            close(icon_inotify_fd);
+        icon_inotify_fd = -1;
+        watched_folders.clear();
+        watched_paths.clear();
+    }
+    icon_update_timeout = nullptr;
+    changed_everything = false;
+    changed_folders.clear();
+    changed_trees.clear();
     
     icon_search_paths.clear();
     icon_search_paths.shrink_to_fit();
     icon_search_paths = std::vector<std::string>();
 }
 
+// tofix.csv parsed into one index per column, so a lookup is a few hash probes instead of a scan of the file
+struct ToFixTable {
+    bool exists = false;
+    ino_t inode = 0;
+    struct timespec mtime = {};
+    off_t size = 0;
+    
+    std::string contents; // The keys below point into this
+    std::vector<std::string> icons;
+    // First row (index into icons) with that value in the column
+    std::unordered_map<std::string_view, uint32_t> by_name;
+    std::unordered_map<std::string_view, uint32_t> by_wm_class;
+    std::unordered_map<std::string_view, uint32_t> by_filename;
+};
+
+static std::mutex to_fix_mutex;
+static auto *to_fix = new ToFixTable;
+
+// Everything after the last '/'
+static std::string_view filename_of(std::string_view path) {
+    auto slash = path.find_last_of('/');
+    return slash == std::string_view::npos ? path : path.substr(slash + 1);
+}
+
+static void load_to_fix_table(const std::string &path, const struct stat &info) {
+#ifdef TRACY_ENABLE
+    ZoneScoped;
+#endif
+    delete to_fix;
+    to_fix = new ToFixTable;
+    to_fix->exists = true;
+    to_fix->inode = info.st_ino;
+    to_fix->mtime = info.st_mtim;
+    to_fix->size = info.st_size;
+    
+    std::ifstream file(path, std::ios_base::in | std::ios_base::binary);
+    if (!file.is_open())
+        return;
+    to_fix->contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    
+    // Rows are name,wm_class,path,icon after a header line. Only the file name part of the path is compared. Same as
+    // the scan this replaced, a row without three commas or a newline at the end is ignored, and if there are more than
+    // three, the icon is what comes after the last one.
+    std::string_view contents = to_fix->contents;
+    size_t line_start = contents.find('\n');
+    if (line_start == std::string_view::npos)
+        return;
+    line_start++;
+    size_t line_end;
+    while ((line_end = contents.find('\n', line_start)) != std::string_view::npos) {
+        std::string_view line = contents.substr(line_start, line_end - line_start);
+        line_start = line_end + 1;
+        
+        std::string_view columns[3];
+        int column = 0;
+        size_t column_start = 0;
+        for (; column < 3; column++) {
+            size_t comma = line.find(',', column_start);
+            if (comma == std::string_view::npos)
+                break;
+            columns[column] = line.substr(column_start, comma - column_start);
+            column_start = comma + 1;
+        }
+        if (column < 3)
+            continue;
+        
+        auto row = (uint32_t) to_fix->icons.size();
+        to_fix->icons.emplace_back(line.substr(line.find_last_of(',') + 1));
+        to_fix->by_name.emplace(columns[0], row);
+        to_fix->by_wm_class.emplace(columns[1], row);
+        to_fix->by_filename.emplace(filename_of(columns[2]), row);
+    }
+}
+
 std::string
 c3ic_fix_desktop_file_icon(const std::string &given_name,
                            const std::string &given_wm_class,
@@ -1061,143 +1729,37 @@ c3ic_fix_desktop_file_icon(const std::string &given_name,
 #ifdef TRACY_ENABLE
     ZoneScoped;
 #endif
-    // mmap tofix.csv file
     const char *home_directory = getenv("HOME");
     std::string to_fix_path(home_directory);
     to_fix_path += "/.config/winbar/tofix.csv";
     
-    struct stat buffer{};
-    int cache_exists = stat(to_fix_path.c_str(), &buffer) == 0;
-    
-    // TODO: we have to compare modified time of the folders to see if we are up to date
-    if (!cache_exists) {
-//        printf("%s doesn't exists\n", to_fix_path.c_str());
-        return given_icon;
-    }
-    
-    // Attempt to mmap the file
-    int file_descriptor = open(to_fix_path.c_str(), O_RDWR, S_IRUSR | S_IWUSR);
-    struct stat sb;
-    if (fstat(file_descriptor, &sb) == -1) {
-//        printf("Couldn't get file size: %s\n", to_fix_path.c_str());
-        close(file_descriptor);
+    std::lock_guard lock(to_fix_mutex);
+    // Only parsed again when the file changes
+    struct stat info{};
+    if (stat(to_fix_path.c_str(), &info) != 0) {
+        if (to_fix->exists) {
+            delete to_fix;
+            to_fix = new ToFixTable;
+        }
         return given_icon;
     }
+    if (!to_fix->exists || to_fix->inode != info.st_ino || to_fix->size != info.st_size ||
+        to_fix->mtime.tv_sec != info.st_mtim.tv_sec || to_fix->mtime.tv_nsec != info.st_mtim.tv_nsec)
+        load_to_fix_table(to_fix_path, info);
     
-    char *to_fix_data = (char *) mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, file_descriptor, 0);
-    if (!to_fix_data) {
-//        printf("Couldn't mmap file.\n");
-        close(file_descriptor);
+    // The earliest row that matches any of the columns wins
+    uint32_t row = UINT32_MAX;
+    auto check = [&row](const std::unordered_map<std::string_view, uint32_t> &index, std::string_view key) {
+        auto found = index.find(key);
+        if (found != index.end() && found->second < row)
+            row = found->second;
+    };
+    check(to_fix->by_name, given_name);
+    check(to_fix->by_wm_class, given_wm_class);
+    check(to_fix->by_filename, filename_of(given_path));
+    if (row == UINT32_MAX)
         return given_icon;
-    }
-    
-    unsigned long index_into_file = 0;
-    
-    // Eat the first line;
-#define MNOT_DONE index_into_file < buffer.st_size
-    while (MNOT_DONE && to_fix_data[index_into_file] != '\n') {
-        index_into_file++;
-    }
-    index_into_file++;
-    
-    int loading_type = 0;
-    int offset = 0;
-    char first[1024 * 6] = {0};
-    char second[1024 * 6] = {0};
-    char third[1024 * 6] = {0};
-    char fourth[1024 * 6] = {0};
-    bool should_change = false;
-    
-    const char *given_name_c = given_name.c_str();
-    const char *given_wm_class_c = given_wm_class.c_str();
-    
-    char given_path_c[1024 * 6] = {0};
-    const char *temp_given_path_c = given_path.c_str();
-    
-    for (int i = 0; i < given_path.size() + 1; i++) {
-        char c = temp_given_path_c[i];
-        if (c == '/') {
-            offset = 0;
-        } else {
-            given_path_c[offset++] = c;
-        }
-    }
-    offset = 0;
-    
-    while (MNOT_DONE) {
-        if (to_fix_data[index_into_file] == ',') {
-            switch (loading_type) {
-                case 0: {
-                    first[offset] = '\0';
-                    if (strcmp(first, given_name_c) == 0) {
-                        should_change = true;
-                    }
-                    break;
-                }
-                case 1: {
-                    second[offset] = '\0';
-                    if (strcmp(second, given_wm_class_c) == 0) {
-                        should_change = true;
-                    }
-                    break;
-                }
-                case 2: {
-                    third[offset] = '\0';
-                    
-                    if (strcmp(third, given_path_c) == 0) {
-                        should_change = true;
-                    }
-                    break;
-                }
-            }
-            index_into_file++;
-            loading_type++;
-            offset = 0;
-            continue;
-        }
-        if (to_fix_data[index_into_file] == '\n') {
-            fourth[offset] = '\0';
-            index_into_file++;
-            if (should_change) {
-                should_change = false;
-                // return fourth
-                munmap(to_fix_data, sb.st_size);
-                close(file_descriptor);
-                return fourth;
-            }
-            loading_type = 0;
-            offset = 0;
-            continue;
-        }
-        switch (loading_type) {
-            case 0: {
-                first[offset++] = to_fix_data[index_into_file++];
-                break;
-            }
-            case 1: {
-                second[offset++] = to_fix_data[index_into_file++];
-                break;
-            }
-            case 2: {
-                // for the directory, we only want to save the file name not the entire directory path
-                char previous_char = to_fix_data[index_into_file];
-                third[offset++] = to_fix_data[index_into_file++];
-                if (previous_char == '/') {
-                    offset = 0;
-                }
-                break;
-            }
-            default: {
-                fourth[offset++] = to_fix_data[index_into_file++];
-                break;
-            }
-        }
-    }
-    
-    munmap(to_fix_data, sb.st_size);
-    close(file_descriptor);
-    
-    return given_icon;
+    return to_fix->icons[row];
 }
 
 std::string
@@ -1213,9 +1775,11 @@ bool has_options(const std::string& name) {
         int start = name.find(':', 1);
         std::string_view icon_name_only = std::string_view(name.data() + start + 1, name.size() - start - 1);
         
-        return ranges.find(icon_name_only) != ranges.end();
+        auto mapping = current_cache();
+        return mapping && find_name(mapping->view, icon_name_only) != nullptr;
     }
-    return ranges.find(name.c_str()) != ranges.end();
+    auto mapping = current_cache();
+    return mapping && find_name(mapping->view, name.c_str()) != nullptr;
 }
 
 bool is_case_insensitive_substring(const std::string_view &str_view, const std::string_view &target) {
@@ -1228,24 +1792,75 @@ bool is_case_insensitive_substring(const std::string_view &str_view, const std::
     ) != str_view.end();
 }
 
-void get_options(std::vector<std::string_view> &names, const std::string &name, int max) {
+void get_options(std::vector<std::string> &names, const std::string &name, int max) {
     std::string_view icon_name_only = name.c_str();
     if (name.size() > 2 && name[0] == ':' && name.find(':', 1) != std::string::npos) {
         int start = name.find(':', 1);
         icon_name_only = std::string_view(name.data() + start + 1, name.size() - start - 1);
     }
-    for (const auto &entry: ranges) {
-        if (is_case_insensitive_substring(entry.first, icon_name_only)) {
+    auto mapping = current_cache();
+    if (!mapping)
+        return;
+    const IconCacheView &view = mapping->view;
+    // Returns true once enough names were found
+    auto consider = [&names, &icon_name_only, &view, max](uint32_t i) {
+        std::string_view entry = view.string(view.names[i].name);
+        if (is_case_insensitive_substring(entry, icon_name_only)) {
             bool only_print = true;
-            for (auto c: entry.first) {
+            for (auto c: entry) {
                 if (!isprint(c))
                     only_print = false;
             }
             if (only_print) {
-                names.push_back(entry.first);
+                names.emplace_back(entry);
                 if (names.size() > max && max != 0)
-                    return;
+                    return true;
             }
         }
+        return false;
+    };
+    
+    // Too short to have a trigram, but then almost every name matches anyways so the scan stops early
+    if (icon_name_only.size() < 3) {
+        for (uint32_t i = 0; i < view.header->name_count; i++)
+            if (consider(i))
+                return;
+        return;
+    }
+    
+    // Only names that contain every trigram of what's searched for can contain all of it
+    std::vector<const IconCacheTrigram *> lists;
+    auto trigrams_end = view.trigrams + view.header->trigram_count;
+    for (size_t i = 0; i + 3 <= icon_name_only.size(); i++) {
+        uint32_t trigram = pack_trigram(icon_name_only.data() + i);
+        auto found = std::lower_bound(view.trigrams, trigrams_end, trigram,
+                                      [](const IconCacheTrigram &entry, uint32_t trigram) {
+                                          return entry.trigram < trigram;
+                                      });
+        if (found == trigrams_end || found->trigram != trigram)
+            return;
+        lists.push_back(found);
+    }
+    std::sort(lists.begin(), lists.end());
+    lists.erase(std::unique(lists.begin(), lists.end()), lists.end());
+    std::sort(lists.begin(), lists.end(), [](const IconCacheTrigram *a, const IconCacheTrigram *b) {
+        return a->posting_count < b->posting_count;
+    });
+    
+    // Walk the shortest list and skip ahead in the others (all ascending, so names still come out sorted)
+    std::vector<const uint32_t *> positions;
+    for (auto list: lists)
+        positions.push_back(view.postings + list->first_posting);
+    auto shortest = lists[0];
+    for (uint32_t p = 0; p < shortest->posting_count; p++) {
+        uint32_t name = view.postings[shortest->first_posting + p];
+        bool in_all = true;
+        for (int l = 1; l < lists.size() && in_all; l++) {
+            auto end = view.postings + lists[l]->first_posting + lists[l]->posting_count;
+            positions[l] = std::lower_bound(positions[l], end, name);
+            in_all = positions[l] != end && *positions[l] == name;
+        }
+        if (in_all && name < view.header->name_count && consider(name))
+            return;
     }
 }
\ No newline at end of file
@@ -10,7 +10,9 @@
 #include <utility>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <algorithm>
+#include <memory>
 #include <mutex>
 
 // Load icons into memory
@@ -40,28 +42,30 @@ enum IconContext {
     NotSet
 };
 
+struct IconCacheMapping;
+
 struct Candidate {
-    std::string parent_path;
-    std::string filename;
-    std::string theme;
+    // The icon cache the candidate was found in (kept mapped for as long as the candidate is around)
+    std::shared_ptr<const IconCacheMapping> mapping;
+    // Index of the folder and name in the icon cache (the strings live in its mmap, so they are never copied),
+    // or -1 if the icon was given as a full path instead of a name.
+    int directory = -1;
+    int name = -1;
+    // Only set for icons given as a full path
+    std::string path;
     int extension;
     int size;
     int scale;
     IconContext context;
-
-    [[nodiscard]] std::string full_path() const {
-        std::string temp = std::string(parent_path).append("/").append(filename);
-        if (extension == 0) {
-            temp.append(".svg");
-        } else if (extension == 1) {
-            temp.append(".png");
-        } else if (extension == 2) {
-            temp.append(".xpm");
-        }
-        temp.erase(std::remove(temp.begin(), temp.end(), '\0'), temp.end());
     
-        return temp;
-    }
+    [[nodiscard]] std::string_view parent_path() const;
+    
+    // The name without the extension
+    [[nodiscard]] std::string_view filename() const;
+    
+    [[nodiscard]] std::string_view theme() const;
+    
+    [[nodiscard]] std::string full_path() const;
     
     int size_index = 10;
     bool is_part_of_current_theme = false;
@@ -90,7 +94,7 @@ void pick_best(std::vector<IconTarget> &targets, int size, IconContext target_co
 
 bool has_options(const std::string& name);
 
-void get_options(std::vector<std::string_view> &names, const std::string &name, int max);
+void get_options(std::vector<std::string> &names, const std::string &name, int max);
 
 std::string
 c3ic_fix_desktop_file_icon(const std::string &given_name,
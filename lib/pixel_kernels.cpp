@@ -0,0 +1,415 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#include "pixel_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PIXEL_KERNELS_X86
+
+#include <immintrin.h>
+
+#endif
+
+// floor(x / 255) for x in [0, 255 * 255] without a division
+static inline uint32_t div_255(uint32_t x) {
+    return (x + 1 + (x >> 8)) >> 8;
+}
+
+static inline uint32_t clamp_alpha(int alpha) {
+    return alpha < 0 ? 0 : (alpha > 255 ? 255 : alpha);
+}
+
+static void dye_scalar(uint32_t *row, int count, uint8_t r, uint8_t g, uint8_t b) {
+    for (int i = 0; i < count; i++) {
+        uint32_t a = row[i] >> 24;
+        row[i] = (a << 24) | (div_255(r * a) << 16) | (div_255(g * a) << 8) | div_255(b * a);
+    }
+}
+
+static void tint_scalar(uint32_t *row, int count, uint8_t r, uint8_t g, uint8_t b) {
+    for (int i = 0; i < count; i++) {
+        uint32_t color = row[i];
+        row[i] = (color & 0xff000000) |
+                 (div_255(((color >> 16) & 0xff) * r) << 16) |
+                 (div_255(((color >> 8) & 0xff) * g) << 8) |
+                 div_255((color & 0xff) * b);
+    }
+}
+
+static void opacity_scalar(uint32_t *row, int count, int delta, int threshold) {
+    for (int i = 0; i < count; i++) {
+        uint32_t color = row[i];
+        uint32_t a = color >> 24;
+        if (a == 0 || (int) a <= threshold)
+            continue;
+        uint32_t new_a = clamp_alpha((int) a + delta);
+        // Done in float so the SIMD versions can match it exactly
+        float scale = (float) new_a / (float) a;
+        uint32_t red = (uint32_t) ((float) ((color >> 16) & 0xff) * scale + 0.5f);
+        uint32_t green = (uint32_t) ((float) ((color >> 8) & 0xff) * scale + 0.5f);
+        uint32_t blue = (uint32_t) ((float) (color & 0xff) * scale + 0.5f);
+        row[i] = (new_a << 24) | (red << 16) | (green << 8) | blue;
+    }
+}
+
+static void sum_scalar(const uint32_t *row, int count, PixelSums *sums) {
+    for (int i = 0; i < count; i++) {
+        uint32_t color = row[i];
+        uint32_t a = color >> 24;
+        sums->a += a;
+        sums->r += (color >> 16) & 0xff;
+        sums->g += (color >> 8) & 0xff;
+        sums->b += color & 0xff;
+        sums->visible += a != 0;
+    }
+}
+
+static void accumulate_scalar(const uint32_t *row, int count, uint32_t *sums) {
+    auto bytes = (const uint8_t *) row;
+    for (int i = 0; i < count * 4; i++)
+        sums[i] += bytes[i];
+}
+
+#ifdef PIXEL_KERNELS_X86
+
+// All the SIMD versions work on one pixel per 32 bit lane, so the 8 bit products (at most 255 * 255) fit in the
+// low half of the lane and the same shift based div_255 can be used.
+
+__attribute__((target("sse2")))
+static inline __m128i div_255_sse2(__m128i x) {
+    return _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(x, _mm_set1_epi32(1)), _mm_srli_epi32(x, 8)), 8);
+}
+
+__attribute__((target("sse2")))
+static void dye_sse2(uint32_t *row, int count, uint8_t r, uint8_t g, uint8_t b) {
+    const __m128i red = _mm_set1_epi32(r);
+    const __m128i green = _mm_set1_epi32(g);
+    const __m128i blue = _mm_set1_epi32(b);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i pixels = _mm_loadu_si128((__m128i *) (row + i));
+        __m128i a = _mm_srli_epi32(pixels, 24);
+        __m128i result = _mm_slli_epi32(a, 24);
+        result = _mm_or_si128(result, _mm_slli_epi32(div_255_sse2(_mm_mullo_epi16(a, red)), 16));
+        result = _mm_or_si128(result, _mm_slli_epi32(div_255_sse2(_mm_mullo_epi16(a, green)), 8));
+        result = _mm_or_si128(result, div_255_sse2(_mm_mullo_epi16(a, blue)));
+        _mm_storeu_si128((__m128i *) (row + i), result);
+    }
+    dye_scalar(row + i, count - i, r, g, b);
+}
+
+__attribute__((target("sse2")))
+static void tint_sse2(uint32_t *row, int count, uint8_t r, uint8_t g, uint8_t b) {
+    const __m128i red = _mm_set1_epi32(r);
+    const __m128i green = _mm_set1_epi32(g);
+    const __m128i blue = _mm_set1_epi32(b);
+    const __m128i low_byte = _mm_set1_epi32(0xff);
+    const __m128i alpha_mask = _mm_set1_epi32((int) 0xff000000);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i pixels = _mm_loadu_si128((__m128i *) (row + i));
+        __m128i result = _mm_and_si128(pixels, alpha_mask);
+        __m128i c = _mm_and_si128(_mm_srli_epi32(pixels, 16), low_byte);
+        result = _mm_or_si128(result, _mm_slli_epi32(div_255_sse2(_mm_mullo_epi16(c, red)), 16));
+        c = _mm_and_si128(_mm_srli_epi32(pixels, 8), low_byte);
+        result = _mm_or_si128(result, _mm_slli_epi32(div_255_sse2(_mm_mullo_epi16(c, green)), 8));
+        c = _mm_and_si128(pixels, low_byte);
+        result = _mm_or_si128(result, div_255_sse2(_mm_mullo_epi16(c, blue)));
+        _mm_storeu_si128((__m128i *) (row + i), result);
+    }
+    tint_scalar(row + i, count - i, r, g, b);
+}
+
+__attribute__((target("sse2")))
+static inline __m128i select_sse2(__m128i mask, __m128i if_true, __m128i if_false) {
+    return _mm_or_si128(_mm_and_si128(mask, if_true), _mm_andnot_si128(mask, if_false));
+}
+
+__attribute__((target("sse2")))
+static void opacity_sse2(uint32_t *row, int count, int delta, int threshold) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i max = _mm_set1_epi32(255);
+    const __m128i delta_v = _mm_set1_epi32(delta);
+    const __m128i threshold_v = _mm_set1_epi32(threshold);
+    const __m128i low_byte = _mm_set1_epi32(0xff);
+    const __m128 half = _mm_set1_ps(0.5f);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i pixels = _mm_loadu_si128((__m128i *) (row + i));
+        __m128i a = _mm_srli_epi32(pixels, 24);
+        __m128i changes = _mm_andnot_si128(_mm_cmpeq_epi32(a, zero), _mm_cmpgt_epi32(a, threshold_v));
+        if (_mm_movemask_epi8(changes) == 0)
+            continue;
+        
+        // SSE2 has no 32 bit min/max
+        __m128i new_a = _mm_add_epi32(a, delta_v);
+        new_a = select_sse2(_mm_cmpgt_epi32(new_a, max), max, new_a);
+        new_a = select_sse2(_mm_cmplt_epi32(new_a, zero), zero, new_a);
+        new_a = select_sse2(changes, new_a, a);
+        
+        // Lanes that don't change divide a by itself (a scale of exactly 1), a zero alpha becomes one to avoid 0 / 0
+        __m128i a_safe = select_sse2(_mm_cmpeq_epi32(a, zero), _mm_set1_epi32(1), a);
+        __m128 scale = _mm_div_ps(_mm_cvtepi32_ps(new_a), _mm_cvtepi32_ps(a_safe));
+        
+        __m128i result = _mm_slli_epi32(new_a, 24);
+        __m128i c = _mm_and_si128(_mm_srli_epi32(pixels, 16), low_byte);
+        c = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(c), scale), half));
+        result = _mm_or_si128(result, _mm_slli_epi32(c, 16));
+        c = _mm_and_si128(_mm_srli_epi32(pixels, 8), low_byte);
+        c = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(c), scale), half));
+        result = _mm_or_si128(result, _mm_slli_epi32(c, 8));
+        c = _mm_and_si128(pixels, low_byte);
+        c = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(c), scale), half));
+        result = _mm_or_si128(result, c);
+        _mm_storeu_si128((__m128i *) (row + i), result);
+    }
+    opacity_scalar(row + i, count - i, delta, threshold);
+}
+
+__attribute__((target("sse2")))
+static uint64_t horizontal_sum_sse2(__m128i v) {
+    alignas(16) uint32_t lanes[4];
+    _mm_store_si128((__m128i *) lanes, v);
+    return (uint64_t) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+__attribute__((target("sse2")))
+static void sum_sse2(const uint32_t *row, int count, PixelSums *sums) {
+    const __m128i low_byte = _mm_set1_epi32(0xff);
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    // Lanes are flushed into the 64 bit totals before they could overflow
+    while (i + 4 <= count) {
+        __m128i a = zero, r = zero, g = zero, b = zero, hidden = zero;
+        int block_start = i;
+        for (; i + 4 <= count && i - block_start < 4 * 65536; i += 4) {
+            __m128i pixels = _mm_loadu_si128((const __m128i *) (row + i));
+            __m128i alpha = _mm_srli_epi32(pixels, 24);
+            a = _mm_add_epi32(a, alpha);
+            r = _mm_add_epi32(r, _mm_and_si128(_mm_srli_epi32(pixels, 16), low_byte));
+            g = _mm_add_epi32(g, _mm_and_si128(_mm_srli_epi32(pixels, 8), low_byte));
+            b = _mm_add_epi32(b, _mm_and_si128(pixels, low_byte));
+            // cmpeq gives -1 for transparent lanes
+            hidden = _mm_sub_epi32(hidden, _mm_cmpeq_epi32(alpha, zero));
+        }
+        sums->a += horizontal_sum_sse2(a);
+        sums->r += horizontal_sum_sse2(r);
+        sums->g += horizontal_sum_sse2(g);
+        sums->b += horizontal_sum_sse2(b);
+        sums->visible += (i - block_start) - horizontal_sum_sse2(hidden);
+    }
+    sum_scalar(row + i, count - i, sums);
+}
+
+__attribute__((target("sse2")))
+static void accumulate_sse2(const uint32_t *row, int count, uint32_t *sums) {
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i pixels = _mm_loadu_si128((const __m128i *) (row + i));
+        __m128i low = _mm_unpacklo_epi8(pixels, zero);
+        __m128i high = _mm_unpackhi_epi8(pixels, zero);
+        __m128i *out = (__m128i *) (sums + i * 4);
+        _mm_storeu_si128(out, _mm_add_epi32(_mm_loadu_si128(out), _mm_unpacklo_epi16(low, zero)));
+        _mm_storeu_si128(out + 1, _mm_add_epi32(_mm_loadu_si128(out + 1), _mm_unpackhi_epi16(low, zero)));
+        _mm_storeu_si128(out + 2, _mm_add_epi32(_mm_loadu_si128(out + 2), _mm_unpacklo_epi16(high, zero)));
+        _mm_storeu_si128(out + 3, _mm_add_epi32(_mm_loadu_si128(out + 3), _mm_unpackhi_epi16(high, zero)));
+    }
+    accumulate_scalar(row + i, count - i, sums + i * 4);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i div_255_avx2(__m256i x) {
+    return _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(x, _mm256_set1_epi32(1)), _mm256_srli_epi32(x, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+static void dye_avx2(uint32_t *row, int count, uint8_t r, uint8_t g, uint8_t b) {
+    const __m256i red = _mm256_set1_epi32(r);
+    const __m256i green = _mm256_set1_epi32(g);
+    const __m256i blue = _mm256_set1_epi32(b);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i pixels = _mm256_loadu_si256((__m256i *) (row + i));
+        __m256i a = _mm256_srli_epi32(pixels, 24);
+        __m256i result = _mm256_slli_epi32(a, 24);
+        result = _mm256_or_si256(result, _mm256_slli_epi32(div_255_avx2(_mm256_mullo_epi16(a, red)), 16));
+        result = _mm256_or_si256(result, _mm256_slli_epi32(div_255_avx2(_mm256_mullo_epi16(a, green)), 8));
+        result = _mm256_or_si256(result, div_255_avx2(_mm256_mullo_epi16(a, blue)));
+        _mm256_storeu_si256((__m256i *) (row + i), result);
+    }
+    dye_sse2(row + i, count - i, r, g, b);
+}
+
+__attribute__((target("avx2")))
+static void tint_avx2(uint32_t *row, int count, uint8_t r, uint8_t g, uint8_t b) {
+    const __m256i red = _mm256_set1_epi32(r);
+    const __m256i green = _mm256_set1_epi32(g);
+    const __m256i blue = _mm256_set1_epi32(b);
+    const __m256i low_byte = _mm256_set1_epi32(0xff);
+    const __m256i alpha_mask = _mm256_set1_epi32((int) 0xff000000);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i pixels = _mm256_loadu_si256((__m256i *) (row + i));
+        __m256i result = _mm256_and_si256(pixels, alpha_mask);
+        __m256i c = _mm256_and_si256(_mm256_srli_epi32(pixels, 16), low_byte);
+        result = _mm256_or_si256(result, _mm256_slli_epi32(div_255_avx2(_mm256_mullo_epi16(c, red)), 16));
+        c = _mm256_and_si256(_mm256_srli_epi32(pixels, 8), low_byte);
+        result = _mm256_or_si256(result, _mm256_slli_epi32(div_255_avx2(_mm256_mullo_epi16(c, green)), 8));
+        c = _mm256_and_si256(pixels, low_byte);
+        result = _mm256_or_si256(result, div_255_avx2(_mm256_mullo_epi16(c, blue)));
+        _mm256_storeu_si256((__m256i *) (row + i), result);
+    }
+    tint_sse2(row + i, count - i, r, g, b);
+}
+
+__attribute__((target("avx2")))
+static void opacity_avx2(uint32_t *row, int count, int delta, int threshold) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i max = _mm256_set1_epi32(255);
+    const __m256i delta_v = _mm256_set1_epi32(delta);
+    const __m256i threshold_v = _mm256_set1_epi32(threshold);
+    const __m256i low_byte = _mm256_set1_epi32(0xff);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i pixels = _mm256_loadu_si256((__m256i *) (row + i));
+        __m256i a = _mm256_srli_epi32(pixels, 24);
+        __m256i changes = _mm256_andnot_si256(_mm256_cmpeq_epi32(a, zero), _mm256_cmpgt_epi32(a, threshold_v));
+        if (_mm256_testz_si256(changes, changes))
+            continue;
+        
+        __m256i new_a = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(a, delta_v), zero), max);
+        new_a = _mm256_blendv_epi8(a, new_a, changes);
+        __m256 scale = _mm256_div_ps(_mm256_cvtepi32_ps(new_a), _mm256_cvtepi32_ps(_mm256_max_epi32(a, one)));
+        
+        __m256i result = _mm256_slli_epi32(new_a, 24);
+        __m256i c = _mm256_and_si256(_mm256_srli_epi32(pixels, 16), low_byte);
+        c = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(c), scale), half));
+        result = _mm256_or_si256(result, _mm256_slli_epi32(c, 16));
+        c = _mm256_and_si256(_mm256_srli_epi32(pixels, 8), low_byte);
+        c = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(c), scale), half));
+        result = _mm256_or_si256(result, _mm256_slli_epi32(c, 8));
+        c = _mm256_and_si256(pixels, low_byte);
+        c = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(c), scale), half));
+        result = _mm256_or_si256(result, c);
+        _mm256_storeu_si256((__m256i *) (row + i), result);
+    }
+    opacity_sse2(row + i, count - i, delta, threshold);
+}
+
+__attribute__((target("avx2")))
+static uint64_t horizontal_sum_avx2(__m256i v) {
+    alignas(32) uint32_t lanes[8];
+    _mm256_store_si256((__m256i *) lanes, v);
+    uint64_t total = 0;
+    for (auto lane: lanes)
+        total += lane;
+    return total;
+}
+
+__attribute__((target("avx2")))
+static void sum_avx2(const uint32_t *row, int count, PixelSums *sums) {
+    const __m256i low_byte = _mm256_set1_epi32(0xff);
+    const __m256i zero = _mm256_setzero_si256();
+    int i = 0;
+    while (i + 8 <= count) {
+        __m256i a = zero, r = zero, g = zero, b = zero, hidden = zero;
+        int block_start = i;
+        for (; i + 8 <= count && i - block_start < 8 * 65536; i += 8) {
+            __m256i pixels = _mm256_loadu_si256((const __m256i *) (row + i));
+            __m256i alpha = _mm256_srli_epi32(pixels, 24);
+            a = _mm256_add_epi32(a, alpha);
+            r = _mm256_add_epi32(r, _mm256_and_si256(_mm256_srli_epi32(pixels, 16), low_byte));
+            g = _mm256_add_epi32(g, _mm256_and_si256(_mm256_srli_epi32(pixels, 8), low_byte));
+            b = _mm256_add_epi32(b, _mm256_and_si256(pixels, low_byte));
+            hidden = _mm256_sub_epi32(hidden, _mm256_cmpeq_epi32(alpha, zero));
+        }
+        sums->a += horizontal_sum_avx2(a);
+        sums->r += horizontal_sum_avx2(r);
+        sums->g += horizontal_sum_avx2(g);
+        sums->b += horizontal_sum_avx2(b);
+        sums->visible += (i - block_start) - horizontal_sum_avx2(hidden);
+    }
+    sum_sse2(row + i, count - i, sums);
+}
+
+__attribute__((target("avx2")))
+static void accumulate_avx2(const uint32_t *row, int count, uint32_t *sums) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        auto bytes = (const uint8_t *) (row + i);
+        auto out = (__m256i *) (sums + i * 4);
+        // Each 8 bytes (two pixels) widen into 8 lanes
+        for (int part = 0; part < 4; part++) {
+            __m256i widened = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (bytes + part * 8)));
+            _mm256_storeu_si256(out + part, _mm256_add_epi32(_mm256_loadu_si256(out + part), widened));
+        }
+    }
+    accumulate_sse2(row + i, count - i, sums + i * 4);
+}
+
+#endif
+
+struct PixelKernels {
+    void (*dye)(uint32_t *, int, uint8_t, uint8_t, uint8_t) = dye_scalar;
+    void (*tint)(uint32_t *, int, uint8_t, uint8_t, uint8_t) = tint_scalar;
+    void (*opacity)(uint32_t *, int, int, int) = opacity_scalar;
+    void (*sum)(const uint32_t *, int, PixelSums *) = sum_scalar;
+    void (*accumulate)(const uint32_t *, int, uint32_t *) = accumulate_scalar;
+    const char *name = "scalar";
+};
+
+static PixelKernels pick_kernels() {
+    PixelKernels kernels;
+#ifdef PIXEL_KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.dye = dye_avx2;
+        kernels.tint = tint_avx2;
+        kernels.opacity = opacity_avx2;
+        kernels.sum = sum_avx2;
+        kernels.accumulate = accumulate_avx2;
+        kernels.name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        kernels.dye = dye_sse2;
+        kernels.tint = tint_sse2;
+        kernels.opacity = opacity_sse2;
+        kernels.sum = sum_sse2;
+        kernels.accumulate = accumulate_sse2;
+        kernels.name = "sse2";
+    }
+#endif
+    return kernels;
+}
+
+static const PixelKernels &kernels() {
+    static PixelKernels picked = pick_kernels();
+    return picked;
+}
+
+void pixel_dye_row(uint32_t *row, int count, uint8_t r, uint8_t g, uint8_t b) {
+    kernels().dye(row, count, r, g, b);
+}
+
+void pixel_tint_row(uint32_t *row, int count, uint8_t r, uint8_t g, uint8_t b) {
+    kernels().tint(row, count, r, g, b);
+}
+
+void pixel_opacity_row(uint32_t *row, int count, int delta, int threshold) {
+    kernels().opacity(row, count, delta, threshold);
+}
+
+void pixel_sum_row(const uint32_t *row, int count, PixelSums *sums) {
+    kernels().sum(row, count, sums);
+}
+
+void pixel_accumulate_row(const uint32_t *row, int count, uint32_t *sums) {
+    kernels().accumulate(row, count, sums);
+}
+
+const char *pixel_kernels_implementation() {
+    return kernels().name;
+}
@@ -0,0 +1,44 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#ifndef WINBAR_PIXEL_KERNELS_H
+#define WINBAR_PIXEL_KERNELS_H
+
+#include <cstdint>
+
+// Row kernels for premultiplied ARGB32 pixels (CAIRO_FORMAT_ARGB32).
+// Each one has a scalar, an SSE2 and an AVX2 version. The fastest one the CPU supports is picked (using cpuid)
+// the first time any of them is called. The SIMD versions produce exactly the same pixels as the scalar ones.
+
+// Replaces the color of every pixel with (r, g, b) (0-255, not premultiplied) while keeping its alpha.
+void pixel_dye_row(uint32_t *row, int count, uint8_t r, uint8_t g, uint8_t b);
+
+// Multiplies the color of every pixel by (r, g, b) (0-255) while keeping its alpha.
+void pixel_tint_row(uint32_t *row, int count, uint8_t r, uint8_t g, uint8_t b);
+
+// Adds delta to the alpha of every pixel whose alpha is above threshold (clamped to 0-255), and rescales the
+// color channels so that the un-premultiplied color stays the same.
+void pixel_opacity_row(uint32_t *row, int count, int delta, int threshold);
+
+struct PixelSums {
+    uint64_t a = 0;
+    uint64_t r = 0;
+    uint64_t g = 0;
+    uint64_t b = 0;
+    // How many pixels had an alpha other than zero
+    uint64_t visible = 0;
+};
+
+// Adds the channels of every pixel to sums (fully transparent pixels are all zeros in premultiplied form, so they
+// only affect the visible count).
+void pixel_sum_row(const uint32_t *row, int count, PixelSums *sums);
+
+// Adds the four bytes of every pixel to sums (4 * count entries, in the same byte order as the pixels in memory).
+// Used to sum up rows for area-average downscaling.
+void pixel_accumulate_row(const uint32_t *row, int count, uint32_t *sums);
+
+// Name of the implementation that was picked ("avx2", "sse2" or "scalar").
+const char *pixel_kernels_implementation();
+
+#endif //WINBAR_PIXEL_KERNELS_H
@@ -0,0 +1,297 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#include "renderer_calibration.h"
+#include "drawer.h"
+#include "utility.h"
+#include "../src/config.h"
+#include "../src/settings_menu.h"
+
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <cerrno>
+#include <sys/stat.h>
+#include <xcb/xcb_aux.h>
+#include <glm/gtc/matrix_transform.hpp>
+
+#ifdef TRACY_ENABLE
+
+#include "../tracy/public/tracy/Tracy.hpp"
+
+#endif
+
+RendererCalibration *renderer_calibration = new RendererCalibration;
+
+// How many frames are painted per backend and size (the first one is not counted since it includes font loading)
+static int calibration_frames = 24;
+
+static std::string calibration_path(bool create_directories) {
+    const char *home_directory = getenv("HOME");
+    if (!home_directory)
+        return "";
+    std::string path(home_directory);
+    path += "/.cache";
+    if (create_directories && mkdir(path.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) == -1)
+        if (errno != EEXIST)
+            return "";
+    path += "/winbar";
+    if (create_directories && mkdir(path.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) == -1)
+        if (errno != EEXIST)
+            return "";
+    path += "/renderer_calibration";
+    return path;
+}
+
+static bool load_calibration(RendererCalibration *calibration) {
+    std::ifstream file(calibration_path(false));
+    if (!file.is_open())
+        return false;
+
+    std::string line;
+    while (std::getline(file, line)) {
+        auto equals = line.find('=');
+        if (equals == std::string::npos)
+            continue;
+        std::string key = line.substr(0, equals);
+        std::string value = line.substr(equals + 1);
+        try {
+            if (key == "gl_renderer") {
+                calibration->gl_renderer = value;
+            } else if (key == "taskbar_w") {
+                calibration->taskbar_w = std::stoi(value);
+            } else if (key == "taskbar_h") {
+                calibration->taskbar_h = std::stoi(value);
+            } else if (key == "popup_w") {
+                calibration->popup_w = std::stoi(value);
+            } else if (key == "popup_h") {
+                calibration->popup_h = std::stoi(value);
+            } else if (key == "dpi") {
+                calibration->dpi = std::stod(value);
+            } else if (key == "start_menu_height") {
+                calibration->start_menu_height = std::stoi(value);
+            } else if (key == "taskbar_cairo_ms") {
+                calibration->taskbar_cairo_ms = std::stod(value);
+            } else if (key == "taskbar_gl_ms") {
+                calibration->taskbar_gl_ms = std::stod(value);
+            } else if (key == "popup_cairo_ms") {
+                calibration->popup_cairo_ms = std::stod(value);
+            } else if (key == "popup_gl_ms") {
+                calibration->popup_gl_ms = std::stod(value);
+            }
+        } catch (...) {
+            return false;
+        }
+    }
+    return calibration->taskbar_cairo_ms > 0 && calibration->taskbar_gl_ms > 0 &&
+           calibration->popup_cairo_ms > 0 && calibration->popup_gl_ms > 0;
+}
+
+static void save_calibration(RendererCalibration *calibration) {
+    std::string path = calibration_path(true);
+    if (path.empty())
+        return;
+    std::ofstream file(path + ".tmp");
+    if (!file.is_open())
+        return;
+    file << "gl_renderer=" << calibration->gl_renderer << std::endl;
+    file << "taskbar_w=" << calibration->taskbar_w << std::endl;
+    file << "taskbar_h=" << calibration->taskbar_h << std::endl;
+    file << "popup_w=" << calibration->popup_w << std::endl;
+    file << "popup_h=" << calibration->popup_h << std::endl;
+    file << "dpi=" << calibration->dpi << std::endl;
+    file << "start_menu_height=" << calibration->start_menu_height << std::endl;
+    file << "taskbar_cairo_ms=" << calibration->taskbar_cairo_ms << std::endl;
+    file << "taskbar_gl_ms=" << calibration->taskbar_gl_ms << std::endl;
+    file << "popup_cairo_ms=" << calibration->popup_cairo_ms << std::endl;
+    file << "popup_gl_ms=" << calibration->popup_gl_ms << std::endl;
+    file.close();
+    rename((path + ".tmp").c_str(), path.c_str());
+}
+
+// Roughly what the taskbar (pinned icons, hover backgrounds, clock) or a menu (rows of text) paints every frame
+static void paint_representative_frame(AppClient *client, int w, int h, bool taskbar) {
+    draw_colored_rect(client, ArgbColor(.12, .12, .12, .9), Bounds(0, 0, w, h));
+    if (taskbar) {
+        for (int i = 0; i < 12; i++) {
+            Bounds b(h * 2 + i * h, 0, h, h);
+            draw_colored_rect(client, ArgbColor(1, 1, 1, .08), b);
+            draw_round_rect(client, ArgbColor(.4, .6, 1, .9),
+                            Bounds(b.x + b.w * .25, b.y + b.h * .25, b.w * .5, b.h * .5), 4 * config->dpi);
+            draw_margins_rect(client, ArgbColor(1, 1, 1, .2), b, 1, 0);
+        }
+        Bounds clock(w - 100 * config->dpi, 0, 100 * config->dpi, h / 2);
+        draw_text(client, 9 * config->dpi, config->font, 1, 1, 1, 1, "12:45 PM", clock);
+        clock.y += h / 2;
+        draw_text(client, 9 * config->dpi, config->font, 1, 1, 1, 1, "10/18/2026", clock);
+    } else {
+        double row_h = 36 * config->dpi;
+        for (int i = 0; i * row_h < h; i++) {
+            Bounds row(0, i * row_h, w, row_h);
+            if (i == 3)
+                draw_round_rect(client, ArgbColor(1, 1, 1, .1), row, 4 * config->dpi);
+            draw_round_rect(client, ArgbColor(.4, .6, 1, .9),
+                            Bounds(8 * config->dpi, row.y + 6 * config->dpi, 24 * config->dpi, 24 * config->dpi),
+                            4 * config->dpi);
+            draw_text(client, 10 * config->dpi, config->font, 1, 1, 1, 1, "Application " + std::to_string(i), row,
+                      5, 44 * config->dpi);
+        }
+    }
+}
+
+// Each backend creates different kinds of FontReference so they can't be reused across measurements
+static void forget_fonts(AppClient *client) {
+    for (auto f: client->ctx->font_manager->fonts)
+        delete f;
+    client->ctx->font_manager->fonts.clear();
+}
+
+static double measure_cairo(App *app, AppClient *client, int w, int h, bool taskbar) {
+    // Painting into an unmapped window might be skipped by the server so we paint into a pixmap instead
+    xcb_pixmap_t pixmap = xcb_generate_id(app->connection);
+    xcb_create_pixmap(app->connection, app->visual->depth, pixmap, app->screen->root, w, h);
+    cairo_surface_t *surface = cairo_xcb_surface_create(app->connection, pixmap, app->argb_visualtype, w, h);
+    cairo_t *window_cr = cairo_create(surface);
+    cairo_surface_destroy(surface);
+    // Like the back buffer client_paint paints into
+    cairo_surface_t *back_buffer = cairo_surface_create_similar(surface, CAIRO_CONTENT_COLOR_ALPHA, w, h);
+    cairo_t *cr = cairo_create(back_buffer);
+
+    cairo_t *client_cr = client->cr;
+    client->cr = cr;
+    client->should_use_gl = false;
+
+    double total = 0;
+    for (int i = 0; i < calibration_frames + 1; i++) {
+        auto start = std::chrono::steady_clock::now();
+        // Same steps client_paint does: clear the back buffer, paint into it, then copy it onto the window
+        cairo_save(cr);
+        cairo_rectangle(cr, 0, 0, w, h);
+        cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+        cairo_fill(cr);
+        cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+        paint_representative_frame(client, w, h, taskbar);
+        cairo_restore(cr);
+        cairo_set_source_surface(window_cr, back_buffer, 0, 0);
+        cairo_set_operator(window_cr, CAIRO_OPERATOR_SOURCE);
+        cairo_paint(window_cr);
+        cairo_surface_flush(surface);
+        // Wait for the server to actually finish the rendering
+        xcb_aux_sync(app->connection);
+        auto end = std::chrono::steady_clock::now();
+        if (i != 0)
+            total += std::chrono::duration<double, std::milli>(end - start).count();
+    }
+
+    client->cr = client_cr;
+    forget_fonts(client);
+    remove_cached_fonts(cr);
+    cairo_destroy(cr);
+    cairo_surface_destroy(back_buffer);
+    cairo_destroy(window_cr);
+    xcb_free_pixmap(app->connection, pixmap);
+    return total / calibration_frames;
+}
+
+static double measure_gl(App *app, AppClient *client, int w, int h, bool taskbar) {
+    client->should_use_gl = true;
+    glXMakeContextCurrent(app->display, client->gl_drawable, client->gl_drawable, client->context);
+    client->bounds->w = w;
+    client->bounds->h = h;
+    client->projection = glm::ortho(0.0f, (float) w, (float) h, 0.0f, 1.0f, -1.0f);
+    client->ctx->shape.update_projection(client->projection);
+    client->ctx->round.update_projection(client->projection);
+    if (client->ctx->buffer->width != w || client->ctx->buffer->height != h)
+        client->ctx->buffer->resize(w, h);
+
+    double total = 0;
+    for (int i = 0; i < calibration_frames + 1; i++) {
+        auto start = std::chrono::steady_clock::now();
+        client->ctx->buffer->push();
+        for (auto f: client->ctx->font_manager->fonts)
+            if (f->font && f->creation_client == client)
+                f->font->update_projection(client->projection);
+        paint_representative_frame(client, w, h, taskbar);
+        // Like measure_cairo's copy onto the window: pop draws the frame buffer into the window's back buffer
+        client->ctx->buffer->pop();
+        // Wait for the GPU (or llvmpipe) to actually finish the rendering
+        glFinish();
+        auto end = std::chrono::steady_clock::now();
+        if (i != 0)
+            total += std::chrono::duration<double, std::milli>(end - start).count();
+    }
+    forget_fonts(client);
+    return total / calibration_frames;
+}
+
+void renderer_calibrate(App *app) {
+#ifdef TRACY_ENABLE
+    ZoneScoped;
+#endif
+    if (!winbar_settings->auto_renderer)
+        return;
+
+    auto calibration = new RendererCalibration;
+    calibration->gl_renderer = app->gl_renderer;
+    calibration->taskbar_w = app->bounds.w;
+    calibration->taskbar_h = config->taskbar_height;
+    calibration->popup_w = 360 * config->dpi;
+    calibration->popup_h = winbar_settings->start_menu_height * config->dpi;
+    calibration->dpi = config->dpi;
+    calibration->start_menu_height = winbar_settings->start_menu_height;
+
+    auto previous = new RendererCalibration;
+    bool cached = load_calibration(previous) && previous->gl_renderer == calibration->gl_renderer &&
+                  previous->taskbar_w == calibration->taskbar_w && previous->taskbar_h == calibration->taskbar_h &&
+                  previous->popup_w == calibration->popup_w && previous->popup_h == calibration->popup_h &&
+                  std::abs(previous->dpi - calibration->dpi) < .001 &&
+                  previous->start_menu_height == calibration->start_menu_height;
+    if (cached) {
+        delete calibration;
+        calibration = previous;
+    } else {
+        delete previous;
+        // Only a miss has to pay for a window and a second OpenGL context
+        Settings settings;
+        settings.w = calibration->taskbar_w;
+        settings.h = calibration->taskbar_h;
+        settings.override_redirect = true;
+        settings.skip_taskbar = true;
+        AppClient *client = client_new(app, settings, "renderer_calibration");
+        if (!client) {
+            delete calibration;
+            return;
+        }
+        // Closing it shouldn't stop the app before the taskbar is even created
+        client->keeps_app_running = false;
+        calibration->taskbar_cairo_ms = measure_cairo(app, client, calibration->taskbar_w, calibration->taskbar_h,
+                                                      true);
+        calibration->popup_cairo_ms = measure_cairo(app, client, calibration->popup_w, calibration->popup_h, false);
+        calibration->taskbar_gl_ms = measure_gl(app, client, calibration->taskbar_w, calibration->taskbar_h, true);
+        calibration->popup_gl_ms = measure_gl(app, client, calibration->popup_w, calibration->popup_h, false);
+        client_close(app, client);
+        save_calibration(calibration);
+    }
+    calibration->valid = true;
+    delete renderer_calibration;
+    renderer_calibration = calibration;
+}
+
+bool renderer_should_use_gl(const std::string &client_name) {
+    if (!winbar_settings->auto_renderer || !renderer_calibration->valid)
+        return winbar_settings->use_opengl;
+    if (client_name == "taskbar")
+        return renderer_calibration->taskbar_gl_ms < renderer_calibration->taskbar_cairo_ms;
+    return renderer_calibration->popup_gl_ms < renderer_calibration->popup_cairo_ms;
+}
+
+std::string renderer_report() {
+    if (!renderer_calibration->valid)
+        return "Not measured yet (restart winbar after turning this on)";
+    char report[256];
+    snprintf(report, sizeof(report), "Taskbar: cairo %.2fms, OpenGL %.2fms. Menus: cairo %.2fms, OpenGL %.2fms",
+             renderer_calibration->taskbar_cairo_ms, renderer_calibration->taskbar_gl_ms,
+             renderer_calibration->popup_cairo_ms, renderer_calibration->popup_gl_ms);
+    return report;
+}
@@ -0,0 +1,45 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#ifndef WINBAR_RENDERER_CALIBRATION_H
+#define WINBAR_RENDERER_CALIBRATION_H
+
+#include "application.h"
+
+#include <string>
+
+// Average milliseconds it took each backend to paint a representative frame.
+struct RendererCalibration {
+    bool valid = false;
+
+    // What was measured with (a new driver, GPU, or different sizes means we have to measure again)
+    std::string gl_renderer;
+    int taskbar_w = 0;
+    int taskbar_h = 0;
+    int popup_w = 0;
+    int popup_h = 0;
+    double dpi = 0;
+    int start_menu_height = 0;
+
+    double taskbar_cairo_ms = 0;
+    double taskbar_gl_ms = 0;
+    double popup_cairo_ms = 0;
+    double popup_gl_ms = 0;
+};
+
+extern RendererCalibration *renderer_calibration;
+
+// Loads the previous calibration from ~/.cache/winbar/renderer_calibration, or if it doesn't exist or is stale,
+// paints a taskbar and a popup sized frame with both cairo and OpenGL and saves the timings.
+// Has to be called after fonts and settings are loaded, but before any client is created.
+void renderer_calibrate(App *app);
+
+// If the client with the given name should paint using OpenGL.
+// The user's "use_opengl" setting wins unless "auto_renderer" is on and a calibration is available.
+bool renderer_should_use_gl(const std::string &client_name);
+
+// Human readable summary of the measured numbers.
+std::string renderer_report();
+
+#endif //WINBAR_RENDERER_CALIBRATION_H
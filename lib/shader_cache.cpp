@@ -0,0 +1,210 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#include "shader_cache.h"
+#include "container.h"
+
+#include <unordered_map>
+#include <vector>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <sys/stat.h>
+
+#ifdef TRACY_ENABLE
+
+#include "../tracy/public/tracy/Tracy.hpp"
+
+#endif
+
+// Bump if the layout of the files written by save_binary changes.
+static uint32_t shader_binary_version = 1;
+
+static std::unordered_map<uint64_t, GLuint> programs;
+
+static uint64_t fnv1a(uint64_t hash, const char *data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char) data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static uint64_t hash_sources(const std::string &vertex_source, const std::string &fragment_source) {
+    uint64_t hash = 14695981039346656037ull;
+    hash = fnv1a(hash, vertex_source.data(), vertex_source.size());
+    // Separator so that moving text from one shader into the other changes the hash
+    hash = fnv1a(hash, "\0", 1);
+    hash = fnv1a(hash, fragment_source.data(), fragment_source.size());
+    return hash;
+}
+
+static bool program_binaries_supported() {
+    static int supported = -1;
+    if (supported == -1) {
+        GLint formats = 0;
+        if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary)
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        supported = formats > 0;
+    }
+    return supported;
+}
+
+static std::string binary_path(uint64_t source_hash) {
+    const char *home_directory = getenv("HOME");
+    if (!home_directory)
+        return "";
+    std::string path(home_directory);
+    path += "/.cache";
+    if (mkdir(path.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) == -1)
+        if (errno != EEXIST)
+            return "";
+    path += "/winbar";
+    if (mkdir(path.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) == -1)
+        if (errno != EEXIST)
+            return "";
+    path += "/shaders";
+    if (mkdir(path.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) == -1)
+        if (errno != EEXIST)
+            return "";
+
+    // Binaries are only valid for the driver that produced them, so the renderer and version are part of the name
+    auto renderer = (const char *) glGetString(GL_RENDERER);
+    auto version = (const char *) glGetString(GL_VERSION);
+    uint64_t driver_hash = 14695981039346656037ull;
+    if (renderer)
+        driver_hash = fnv1a(driver_hash, renderer, strlen(renderer));
+    if (version)
+        driver_hash = fnv1a(driver_hash, version, strlen(version));
+
+    char name[64];
+    snprintf(name, sizeof(name), "/%016lx_%016lx.bin", (unsigned long) source_hash, (unsigned long) driver_hash);
+    path += name;
+    return path;
+}
+
+static bool link_succeeded(GLuint program, bool report) {
+    GLint success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success && report) {
+        char infoLog[512];
+        glGetProgramInfoLog(program, 512, NULL, infoLog);
+        fprintf(stderr, "Shader Program Linking Failed:\n%s\n", infoLog);
+    }
+    return success;
+}
+
+static GLuint load_binary(const std::string &path) {
+    std::ifstream file(path, std::ios_base::in | std::ios_base::binary);
+    if (!file.is_open())
+        return 0;
+
+    uint32_t version = 0;
+    GLenum format = 0;
+    uint32_t length = 0;
+    file.read(reinterpret_cast<char *>(&version), sizeof(version));
+    file.read(reinterpret_cast<char *>(&format), sizeof(format));
+    file.read(reinterpret_cast<char *>(&length), sizeof(length));
+    if (!file || version != shader_binary_version || length == 0)
+        return 0;
+
+    std::vector<char> binary(length);
+    file.read(binary.data(), length);
+    if (!file)
+        return 0;
+
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, format, binary.data(), length);
+    // The driver is allowed to reject binaries (after an update for instance), in which case we just compile
+    if (!link_succeeded(program, false)) {
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+static void save_binary(GLuint program, const std::string &path) {
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    GLsizei written = 0;
+    glGetProgramBinary(program, length, &written, &format, binary.data());
+    if (written <= 0)
+        return;
+
+    std::string temp_path = path + ".tmp";
+    std::ofstream file(temp_path, std::ios_base::out | std::ios_base::binary);
+    if (!file.is_open())
+        return;
+
+    uint32_t written_length = written;
+#define WRITE_NUM(num) \
+    reinterpret_cast<const char *>(&num), sizeof(num) \
+
+    file.write(WRITE_NUM(shader_binary_version));
+    file.write(WRITE_NUM(format));
+    file.write(WRITE_NUM(written_length));
+    file.write(binary.data(), written);
+#undef WRITE_NUM
+    file.close();
+    if (file)
+        rename(temp_path.data(), path.data());
+}
+
+static GLuint compile_program(const std::string &vertex_source, const std::string &fragment_source, bool retrievable) {
+    GLuint vertexShader = compileShader(vertex_source, GL_VERTEX_SHADER);
+    GLuint fragmentShader = compileShader(fragment_source, GL_FRAGMENT_SHADER);
+
+    GLuint program = glCreateProgram();
+    if (retrievable)
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glAttachShader(program, vertexShader);
+    glAttachShader(program, fragmentShader);
+    glLinkProgram(program);
+    link_succeeded(program, true);
+
+    // Shaders can be deleted once linked into a program
+    glDetachShader(program, vertexShader);
+    glDetachShader(program, fragmentShader);
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+    return program;
+}
+
+GLuint shader_cache_program(const std::string &vertex_source, const std::string &fragment_source) {
+#ifdef TRACY_ENABLE
+    ZoneScoped;
+#endif
+    uint64_t source_hash = hash_sources(vertex_source, fragment_source);
+    auto found = programs.find(source_hash);
+    if (found != programs.end())
+        return found->second;
+
+    bool binaries = program_binaries_supported();
+    std::string path;
+    GLuint program = 0;
+    if (binaries) {
+        path = binary_path(source_hash);
+        if (!path.empty())
+            program = load_binary(path);
+    }
+
+    if (!program) {
+        program = compile_program(vertex_source, fragment_source, binaries);
+        if (binaries && !path.empty() && link_succeeded(program, false))
+            save_binary(program, path);
+    }
+
+    programs[source_hash] = program;
+    return program;
+}
+
+void shader_cache_clear() {
+    programs.clear();
+}
@@ -0,0 +1,22 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#ifndef WINBAR_SHADER_CACHE_H
+#define WINBAR_SHADER_CACHE_H
+
+#include <GL/glew.h>
+#include <string>
+
+// Returns a linked program for the given sources. Programs are shared by every client (their contexts are all in
+// the share group of App::share_context), so each source pair is only ever compiled once per process. When the driver
+// supports program binaries, the linked result is also stored in ~/.cache/winbar/shaders and reloaded on the next
+// start instead of compiling the GLSL again.
+//
+// The returned program is owned by the cache and must not be deleted with glDeleteProgram.
+GLuint shader_cache_program(const std::string &vertex_source, const std::string &fragment_source);
+
+// Forgets every program (does not delete them since the share group is destroyed right after this is called).
+void shader_cache_clear();
+
+#endif //WINBAR_SHADER_CACHE_H
@@ -0,0 +1,162 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#include "shm_surface.h"
+
+#include <cstdio>
+#include <cstring>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <xcb/shm.h>
+
+#ifdef TRACY_ENABLE
+
+#include "../tracy/public/tracy/Tracy.hpp"
+
+#endif
+
+struct ShmSegment {
+    xcb_connection_t *connection = nullptr;
+    xcb_shm_seg_t seg = 0;
+    void *data = nullptr;
+};
+
+static cairo_user_data_key_t shm_segment_key;
+
+bool shm_available(App *app) {
+    // -1 not checked yet, 0 not available, 1 available
+    static int available = -1;
+    if (available != -1)
+        return available;
+    available = 0;
+    
+    const xcb_query_extension_reply_t *extension = xcb_get_extension_data(app->connection, &xcb_shm_id);
+    if (!extension || !extension->present)
+        return available;
+    xcb_shm_query_version_reply_t *version = xcb_shm_query_version_reply(app->connection,
+                                                                         xcb_shm_query_version(app->connection),
+                                                                         nullptr);
+    if (!version)
+        return available;
+    free(version);
+    
+    // The extension can be present even when the server is on another machine, in which case attaching fails
+    int shmid = shmget(IPC_PRIVATE, 4, IPC_CREAT | 0600);
+    if (shmid == -1)
+        return available;
+    xcb_shm_seg_t seg = xcb_generate_id(app->connection);
+    xcb_generic_error_t *error = xcb_request_check(app->connection,
+                                                   xcb_shm_attach_checked(app->connection, seg, shmid, false));
+    shmctl(shmid, IPC_RMID, nullptr);
+    if (error) {
+        free(error);
+        return available;
+    }
+    xcb_shm_detach(app->connection, seg);
+    available = 1;
+    return available;
+}
+
+static void destroy_segment(void *user_data) {
+    auto segment = (ShmSegment *) user_data;
+    xcb_shm_detach(segment->connection, segment->seg);
+    xcb_flush(segment->connection);
+    shmdt(segment->data);
+    delete segment;
+}
+
+cairo_surface_t *shm_surface_create(App *app, int w, int h) {
+#ifdef TRACY_ENABLE
+    ZoneScoped;
+#endif
+    if (w <= 0 || h <= 0 || !shm_available(app))
+        return cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+    
+    int stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, w);
+    int shmid = shmget(IPC_PRIVATE, (size_t) stride * h, IPC_CREAT | 0600);
+    if (shmid == -1)
+        return cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+    void *data = shmat(shmid, nullptr, 0);
+    if (data == (void *) -1) {
+        shmctl(shmid, IPC_RMID, nullptr);
+        return cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+    }
+    
+    xcb_shm_seg_t seg = xcb_generate_id(app->connection);
+    xcb_generic_error_t *error = xcb_request_check(app->connection,
+                                                   xcb_shm_attach_checked(app->connection, seg, shmid, false));
+    // Marked for removal right away so the segment is freed once both sides detach (even if we crash)
+    shmctl(shmid, IPC_RMID, nullptr);
+    if (error) {
+        free(error);
+        shmdt(data);
+        return cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+    }
+    memset(data, 0, (size_t) stride * h);
+    
+    cairo_surface_t *surface = cairo_image_surface_create_for_data((unsigned char *) data, CAIRO_FORMAT_ARGB32,
+                                                                   w, h, stride);
+    auto segment = new ShmSegment;
+    segment->connection = app->connection;
+    segment->seg = seg;
+    segment->data = data;
+    if (cairo_surface_set_user_data(surface, &shm_segment_key, segment, destroy_segment) != CAIRO_STATUS_SUCCESS) {
+        destroy_segment(segment);
+        cairo_surface_destroy(surface);
+        return cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+    }
+    return surface;
+}
+
+bool shm_surface_is_shared(cairo_surface_t *surface) {
+    return surface && cairo_surface_get_user_data(surface, &shm_segment_key) != nullptr;
+}
+
+bool shm_surface_capture(App *app, cairo_surface_t *surface, xcb_drawable_t drawable, int depth,
+                         int first_row, int rows) {
+#ifdef TRACY_ENABLE
+    ZoneScoped;
+#endif
+    // Other depths don't use four bytes per pixel so they can't be written straight into an ARGB32 surface
+    if (depth != 24 && depth != 32)
+        return false;
+    auto segment = (ShmSegment *) cairo_surface_get_user_data(surface, &shm_segment_key);
+    if (!segment)
+        return false;
+    
+    int w = cairo_image_surface_get_width(surface);
+    int h = cairo_image_surface_get_height(surface);
+    int stride = cairo_image_surface_get_stride(surface);
+    if (rows == -1)
+        rows = h - first_row;
+    if (first_row < 0 || rows <= 0 || first_row + rows > h)
+        return false;
+    cairo_surface_flush(surface);
+    
+    xcb_generic_error_t *error = nullptr;
+    xcb_shm_get_image_reply_t *reply = xcb_shm_get_image_reply(
+            app->connection,
+            xcb_shm_get_image(app->connection, drawable, 0, first_row, w, rows, ~0u, XCB_IMAGE_FORMAT_Z_PIXMAP,
+                              segment->seg, first_row * stride),
+            &error);
+    if (error) {
+        free(error);
+        return false;
+    }
+    if (!reply)
+        return false;
+    free(reply);
+    
+    // The X server leaves whatever was in the padding byte of depth 24 windows, cairo expects opaque pixels
+    if (depth == 24) {
+        auto data = cairo_image_surface_get_data(surface);
+        for (int row = first_row; row < first_row + rows; row++) {
+            auto pixels = (uint32_t *) (data + row * stride);
+            for (int col = 0; col < w; col++)
+                pixels[col] |= 0xff000000;
+        }
+    }
+    cairo_surface_mark_dirty_rectangle(surface, 0, first_row, w, rows);
+    return true;
+}
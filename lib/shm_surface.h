@@ -0,0 +1,33 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#ifndef WINBAR_SHM_SURFACE_H
+#define WINBAR_SHM_SURFACE_H
+
+#include "application.h"
+
+#include <cairo.h>
+#include <xcb/xcb.h>
+
+// If the MIT-SHM extension can be used on this connection (it can't over the network for instance).
+bool shm_available(App *app);
+
+// Returns an ARGB32 image surface whose pixels live in a shared memory segment that is also attached to the
+// X server, so that the server can read and write them directly instead of sending them over the socket.
+// If MIT-SHM can't be used, a regular image surface is returned instead, so the result is always usable with cairo.
+// Destroying the surface with cairo_surface_destroy also detaches and frees the segment.
+cairo_surface_t *shm_surface_create(App *app, int w, int h);
+
+// If the surface was created by shm_surface_create and is really backed by shared memory.
+bool shm_surface_is_shared(cairo_surface_t *surface);
+
+// Copies rows first_row to first_row + rows (all of them if rows is -1) of the drawable into the same rows of the
+// surface with ShmGetImage. Whole rows are copied since that's what lines up with the layout of the segment.
+// Windows with a depth of 24 have their alpha forced to opaque.
+// Returns false if the surface isn't shared, the depth isn't 24 or 32, or the server refused the request
+// (the window changed size for example), in which case the caller should fall back to going through cairo.
+bool shm_surface_capture(App *app, cairo_surface_t *surface, xcb_drawable_t drawable, int depth,
+                         int first_row = 0, int rows = -1);
+
+#endif //WINBAR_SHM_SURFACE_H
@@ -0,0 +1,219 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#include "thumbnail_scaler.h"
+#include "pixel_kernels.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#ifdef TRACY_ENABLE
+
+#include "../tracy/public/tracy/Tracy.hpp"
+
+#endif
+
+struct ScaleJob {
+    cairo_surface_t *source = nullptr;
+    int max_w = 0;
+    int max_h = 0;
+    std::function<void(std::vector<ThumbnailMip> mips)> on_done;
+    std::vector<ThumbnailMip> mips;
+};
+
+// Never destroyed: the detached worker is still waiting on them when the program exits, and destroying a condition
+// variable someone waits on hangs
+static std::mutex &jobs_mutex = *new std::mutex;
+static std::condition_variable &jobs_condition = *new std::condition_variable;
+static std::deque<ScaleJob *> pending_jobs;
+static std::deque<ScaleJob *> finished_jobs;
+static bool worker_started = false;
+
+// The worker writes a byte into it whenever a job finishes to wake up the main thread's poll
+static int finished_pipe[2] = {-1, -1};
+
+void downscale_area_average(const unsigned char *source, int source_w, int source_h, int source_stride,
+                            unsigned char *destination, int destination_w, int destination_h, int destination_stride) {
+#ifdef TRACY_ENABLE
+    ZoneScoped;
+#endif
+    if (destination_w <= 0 || destination_h <= 0)
+        return;
+    std::vector<int> column_starts(destination_w + 1);
+    for (int x = 0; x <= destination_w; x++)
+        column_starts[x] = (int) ((long) x * source_w / destination_w);
+    
+    // Source rows are summed vertically first (the part that touches every source pixel, so it's SIMD),
+    // then each destination pixel sums its columns from that.
+    std::vector<uint32_t> sums(source_w * 4);
+    for (int y = 0; y < destination_h; y++) {
+        int row_start = (int) ((long) y * source_h / destination_h);
+        int row_end = (int) ((long) (y + 1) * source_h / destination_h);
+        std::fill(sums.begin(), sums.end(), 0);
+        for (int row = row_start; row < row_end; row++)
+            pixel_accumulate_row((const uint32_t *) (source + row * source_stride), source_w, sums.data());
+        
+        auto out = destination + y * destination_stride;
+        for (int x = 0; x < destination_w; x++) {
+            int column_start = column_starts[x];
+            int column_end = column_starts[x + 1];
+            uint32_t total[4] = {0, 0, 0, 0};
+            for (int column = column_start; column < column_end; column++)
+                for (int c = 0; c < 4; c++)
+                    total[c] += sums[column * 4 + c];
+            uint32_t count = (column_end - column_start) * (row_end - row_start);
+            for (int c = 0; c < 4; c++)
+                out[x * 4 + c] = count ? (total[c] + count / 2) / count : 0;
+        }
+    }
+}
+
+static cairo_surface_t *area_average(cairo_surface_t *source, int w, int h) {
+    cairo_surface_t *result = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+    if (cairo_surface_status(result) != CAIRO_STATUS_SUCCESS)
+        return result;
+    cairo_surface_flush(result);
+    downscale_area_average(cairo_image_surface_get_data(source), cairo_image_surface_get_width(source),
+                           cairo_image_surface_get_height(source), cairo_image_surface_get_stride(source),
+                           cairo_image_surface_get_data(result), w, h, cairo_image_surface_get_stride(result));
+    cairo_surface_mark_dirty(result);
+    return result;
+}
+
+static std::vector<ThumbnailMip> build_mips(cairo_surface_t *source, int max_w, int max_h) {
+#ifdef TRACY_ENABLE
+    ZoneScoped;
+#endif
+    std::vector<ThumbnailMip> mips;
+    int w = cairo_image_surface_get_width(source);
+    int h = cairo_image_surface_get_height(source);
+    double scale = 1;
+    // Levels bigger than this would never be picked, so they aren't kept (half of a 4K window is 8MB)
+    while ((w / 2 >= max_w * 2 || h / 2 >= max_h * 2) && w / 2 > 0 && h / 2 > 0) {
+        w /= 2;
+        h /= 2;
+        scale /= 2;
+    }
+    
+    // The first level comes straight from the source in one pass, the rest from the level before
+    cairo_surface_t *level = area_average(source, w, h);
+    mips.push_back({level, scale});
+    for (int i = 0; i < 2 && w / 2 > 0 && h / 2 > 0; i++) {
+        w /= 2;
+        h /= 2;
+        scale /= 2;
+        level = area_average(level, w, h);
+        mips.push_back({level, scale});
+    }
+    return mips;
+}
+
+static void worker() {
+    while (true) {
+        ScaleJob *job;
+        {
+            std::unique_lock<std::mutex> lock(jobs_mutex);
+            jobs_condition.wait(lock, []() { return !pending_jobs.empty(); });
+            job = pending_jobs.front();
+            pending_jobs.pop_front();
+        }
+        
+        job->mips = build_mips(job->source, job->max_w, job->max_h);
+        
+        {
+            std::lock_guard<std::mutex> lock(jobs_mutex);
+            finished_jobs.push_back(job);
+        }
+        char byte = 1;
+        write(finished_pipe[1], &byte, 1);
+    }
+}
+
+static void jobs_finished_wakeup(App *app, int fd, void *) {
+    char buffer[64];
+    while (read(fd, buffer, sizeof(buffer)) > 0) {}
+    
+    std::deque<ScaleJob *> finished;
+    {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+        finished.swap(finished_jobs);
+    }
+    for (auto job: finished) {
+        cairo_surface_destroy(job->source);
+        job->on_done(std::move(job->mips));
+        delete job;
+    }
+}
+
+void thumbnail_mips_async(App *app, cairo_surface_t *source, int max_w, int max_h,
+                          std::function<void(std::vector<ThumbnailMip> mips)> on_done) {
+    if (!worker_started) {
+        worker_started = true;
+        if (pipe2(finished_pipe, O_NONBLOCK | O_CLOEXEC) == -1) {
+            perror("pipe2");
+        } else {
+            std::thread(worker).detach();
+        }
+    }
+    // The worker outlives an in-process restart, but the new App has to be told about the pipe again
+    if (finished_pipe[0] != -1) {
+        bool polled = false;
+        for (const auto &descriptor: app->descriptors_being_polled)
+            if (descriptor.file_descriptor == finished_pipe[0])
+                polled = true;
+        if (!polled)
+            poll_descriptor(app, finished_pipe[0], EPOLLIN, jobs_finished_wakeup, nullptr, "Thumbnail scaler");
+    }
+    // Couldn't start the worker, so just do it right here
+    if (finished_pipe[0] == -1) {
+        on_done(build_mips(source, max_w, max_h));
+        return;
+    }
+    
+    auto job = new ScaleJob;
+    job->source = cairo_surface_reference(source);
+    job->max_w = max_w;
+    job->max_h = max_h;
+    job->on_done = std::move(on_done);
+    {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+        pending_jobs.push_back(job);
+    }
+    jobs_condition.notify_one();
+}
+
+cairo_surface_t *thumbnail_from_mips(const std::vector<ThumbnailMip> &mips, double scale_w, double scale_h,
+                                     int target_w, int target_h) {
+#ifdef TRACY_ENABLE
+    ZoneScoped;
+#endif
+    cairo_surface_t *result = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, target_w, target_h);
+    if (mips.empty() || cairo_surface_status(result) != CAIRO_STATUS_SUCCESS)
+        return result;
+    // Levels go from largest to smallest, so the last one that's still big enough is the closest
+    const ThumbnailMip *picked = &mips[0];
+    for (const auto &mip: mips)
+        if (mip.scale >= scale_w && mip.scale >= scale_h)
+            picked = &mip;
+    
+    cairo_t *cr = cairo_create(result);
+    cairo_scale(cr, scale_w / picked->scale, scale_h / picked->scale);
+    cairo_set_source_surface(cr, picked->surface, 0, 0);
+    cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_GOOD);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+    return result;
+}
+
+void thumbnail_mips_free(std::vector<ThumbnailMip> &mips) {
+    for (auto &mip: mips)
+        cairo_surface_destroy(mip.surface);
+    mips.clear();
+}
@@ -0,0 +1,42 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+#ifndef WINBAR_THUMBNAIL_SCALER_H
+#define WINBAR_THUMBNAIL_SCALER_H
+
+#include "application.h"
+
+#include <cairo.h>
+#include <functional>
+#include <vector>
+
+// One level of a thumbnail mip chain: the window capture shrunk by scale (a power of two).
+struct ThumbnailMip {
+    cairo_surface_t *surface = nullptr;
+    double scale = 1;
+};
+
+// Builds a mip chain of source on a worker thread, then calls on_done with it on the main thread (on_done owns the
+// levels). The largest level is the first power of two reduction of source that's no bigger than twice max_w x max_h
+// (the largest a preview can be), followed by two more levels at half the size of the one before. Every level is
+// an area-average (box filter) of the source.
+//
+// The source is referenced until the worker is done with it, but the caller must not draw into it until on_done
+// is called since the worker reads the pixels without any locking.
+void thumbnail_mips_async(App *app, cairo_surface_t *source, int max_w, int max_h,
+                          std::function<void(std::vector<ThumbnailMip> mips)> on_done);
+
+// Draws the mip level closest to (but not smaller than) scale_w, scale_h into a new target_w x target_h surface
+// (at 0, 0). Since the level is at most twice as large as needed, this is a cheap blit.
+cairo_surface_t *thumbnail_from_mips(const std::vector<ThumbnailMip> &mips, double scale_w, double scale_h,
+                                     int target_w, int target_h);
+
+void thumbnail_mips_free(std::vector<ThumbnailMip> &mips);
+
+// Scales the pixels of an ARGB32 image by averaging all the source pixels that fall in each destination pixel.
+// Destination must not be larger than the source in either direction.
+void downscale_area_average(const unsigned char *source, int source_w, int source_h, int source_stride,
+                            unsigned char *destination, int destination_w, int destination_h, int destination_stride);
+
+#endif //WINBAR_THUMBNAIL_SCALER_H
@@ -2,6 +2,9 @@
 #include "utility.h"
 #include "hsluv.h"
 #include "icons.h"
+#include "pixel_kernels.h"
+#include "icon_pixmap_cache.h"
+#include "icon_loader.h"
 #include "../src/settings_menu.h"
 #include <stdio.h>
 #include <X11/Xlib.h>
@@ -39,31 +42,17 @@ void dye_surface(cairo_surface_t *surface, ArgbColor argb_color) {
     int height = cairo_image_surface_get_height(surface);
     int stride = cairo_image_surface_get_stride(surface);
     
-    for (int y = 0; y < height; y++) {
-        auto row = (uint32_t *) data;
-        data += stride;
-        
-        for (int x = 0; x < width; x++) {
-            unsigned int color = *row;
-            
-            unsigned int alpha = ((color >> 24) & 0xFF);
-            
-            unsigned int red = std::floor(argb_color.r * 255);
-            unsigned int green = std::floor(argb_color.g * 255);
-            unsigned int blue = std::floor(argb_color.b * 255);
-            
-            // pre multiplied alpha
-            // a r g b
-            // unsigned int set_argb = (0x44 << 24) | (0x44 << 16) | (0x00 << 8) |
-            // 0x44; https://microsoft.github.io/Win2D/html/PremultipliedAlpha.htm
-            // https://www.cairographics.org/manual/cairo-Image-Surfaces.html#cairo-format-t
-            unsigned int set_color = (alpha << 24) | ((red * alpha / 255) << 16) |
-                                     (green * alpha / 255 << 8) | blue * alpha / 255;
-            
-            *row = set_color;
-            row++;
-        }
-    }
+    uint8_t red = std::floor(argb_color.r * 255);
+    uint8_t green = std::floor(argb_color.g * 255);
+    uint8_t blue = std::floor(argb_color.b * 255);
+    
+    // pre multiplied alpha
+    // https://microsoft.github.io/Win2D/html/PremultipliedAlpha.htm
+    // https://www.cairographics.org/manual/cairo-Image-Surfaces.html#cairo-format-t
+    for (int y = 0; y < height; y++)
+        pixel_dye_row((uint32_t *) (data + y * stride), width, red, green, blue);
+    
+    cairo_surface_mark_dirty(surface);
 }
 
 void tint_surface(cairo_surface_t *surface, ArgbColor argb_color) {
@@ -79,33 +68,15 @@ void tint_surface(cairo_surface_t *surface, ArgbColor argb_color) {
     int height = cairo_image_surface_get_height(surface);
     int stride = cairo_image_surface_get_stride(surface);
 
-    for (int y = 0; y < height; y++) {
-        auto row = (uint32_t *) data;
-        data += stride;
-
-        for (int x = 0; x < width; x++) {
-            uint32_t color = *row;
+    // Convert tint color to 0–255 range
+    uint8_t tint_r = static_cast<uint8_t>(argb_color.r * 255);
+    uint8_t tint_g = static_cast<uint8_t>(argb_color.g * 255);
+    uint8_t tint_b = static_cast<uint8_t>(argb_color.b * 255);
 
-            uint8_t a = (color >> 24) & 0xFF;
-            uint8_t r = (color >> 16) & 0xFF;
-            uint8_t g = (color >> 8)  & 0xFF;
-            uint8_t b = (color)       & 0xFF;
-
-            // Convert tint color to 0–255 range
-            uint8_t tint_r = static_cast<uint8_t>(argb_color.r * 255);
-            uint8_t tint_g = static_cast<uint8_t>(argb_color.g * 255);
-            uint8_t tint_b = static_cast<uint8_t>(argb_color.b * 255);
-
-            // Multiply source color by tint color (tinting)
-            // Values are premultiplied by alpha already in Cairo
-            uint8_t new_r = (r * tint_r) / 255;
-            uint8_t new_g = (g * tint_g) / 255;
-            uint8_t new_b = (b * tint_b) / 255;
-
-            *row = (a << 24) | (new_r << 16) | (new_g << 8) | new_b;
-            row++;
-        }
-    }
+    // Multiply source color by tint color (tinting)
+    // Values are premultiplied by alpha already in Cairo
+    for (int y = 0; y < height; y++)
+        pixel_tint_row((uint32_t *) (data + y * stride), width, tint_r, tint_g, tint_b);
 
     cairo_surface_mark_dirty(surface);
 }
@@ -123,41 +94,11 @@ void dye_opacity(cairo_surface_t *surface, double amount, int thresh_hold) {
     int height = cairo_image_surface_get_height(surface);
     int stride = cairo_image_surface_get_stride(surface);
     
-    for (int y = 0; y < height; y++) {
-        auto row = (uint32_t *) data;
-        data += stride;
-        
-        for (int x = 0; x < width; x++) {
-            unsigned int color = *row;
-            
-            unsigned int alpha = ((color >> 24) & 0xFF);
-            if (alpha != 0) {
-                if (alpha > thresh_hold) {
-                    alpha += (amount * 255);
-                    if (alpha > 255) {
-                        alpha = 255;
-                    }
-                    if (alpha < 0) {
-                        alpha = 0;
-                    }
-                }
-            }
-            unsigned int red = ((color >> 16) & 0xFF);
-            unsigned int green = ((color >> 8) & 0xFF);
-            unsigned int blue = ((color >> 0) & 0xFF);
-            
-            // pre multiplied alpha
-            // a r g b
-            // unsigned int set_argb = (0x44 << 24) | (0x44 << 16) | (0x00 << 8) |
-            // 0x44; https://microsoft.github.io/Win2D/html/PremultipliedAlpha.htm
-            // https://www.cairographics.org/manual/cairo-Image-Surfaces.html#cairo-format-t
-            unsigned int set_color = (alpha << 24) | ((red * alpha / 255) << 16) |
-                                     (green * alpha / 255 << 8) | blue * alpha / 255;
-            
-            *row = set_color;
-            row++;
-        }
-    }
+    int delta = amount * 255;
+    for (int y = 0; y < height; y++)
+        pixel_opacity_row((uint32_t *) (data + y * stride), width, delta, thresh_hold);
+    
+    cairo_surface_mark_dirty(surface);
 }
 
 void get_average_color(cairo_surface_t *surface, ArgbColor *result) {
@@ -177,39 +118,18 @@ void get_average_color(cairo_surface_t *surface, ArgbColor *result) {
     int height = cairo_image_surface_get_height(surface);
     int stride = cairo_image_surface_get_stride(surface);
     
-    int total_pixels = width * height;
-    double a = 0;
-    double r = 0;
-    double g = 0;
-    double b = 0;
+    PixelSums sums;
+    for (int y = 0; y < height; y++)
+        pixel_sum_row((const uint32_t *) (data + y * stride), width, &sums);
     
-    for (int y = 0; y < height; y++) {
-        auto row = (uint32_t *) data;
-        data += stride;
-        
-        for (int x = 0; x < width; x++) {
-            unsigned int color = *row;
-            
-            unsigned int alpha = ((color >> 24) & 0xFF);
-            unsigned int red = ((color >> 16) & 0xFF);
-            unsigned int green = ((color >> 8) & 0xFF);
-            unsigned int blue = ((color >> 0) & 0xFF);
-            if (alpha == 0) {
-                total_pixels--;
-            } else {
-                a += (((double) alpha) / 255);
-                r += (((double) red) / 255);
-                g += (((double) green) / 255);
-                b += (((double) blue) / 255);
-            }
-            
-            row++;
-        }
-    }
-    result->a = a / (total_pixels);
-    result->r = r / (total_pixels);
-    result->g = g / (total_pixels);
-    result->b = b / (total_pixels);
+    // Fully transparent pixels don't count towards the average
+    if (sums.visible == 0)
+        return;
+    double total = (double) sums.visible * 255;
+    result->a = sums.a / total;
+    result->r = sums.r / total;
+    result->g = sums.g / total;
+    result->b = sums.b / total;
 }
 
 ArgbColor
@@ -499,15 +419,10 @@ load_icon_full_path(App *app, AppClient *client_entity, cairo_surface_t **surfac
 #ifdef TRACY_ENABLE
     ZoneScoped;
 #endif
-    if (path.find("svg") != std::string::npos) {
-        *surface = accelerated_surface(app, client_entity, target_size, target_size);
-        paint_svg_to_surface(*surface, path, target_size);
-    } else if (path.find("png") != std::string::npos) {
-        *surface = accelerated_surface(app, client_entity, target_size, target_size);
-        paint_png_to_surface(*surface, path, target_size);
-    } else if (path.find("xpm") != std::string::npos) {
-        *surface = accelerated_surface(app, client_entity, target_size, target_size);
-        paint_xpm_to_surface(*surface, path, target_size);
+    if (path.find("svg") != std::string::npos || path.find("png") != std::string::npos ||
+        path.find("xpm") != std::string::npos) {
+        // Transparent until the icon is decoded, then client_entity gets repainted
+        *surface = icon_load_async(app, client_entity, path, target_size);
     }
 }
 
@@ -1085,12 +1000,8 @@ bool icon(AppClient *client, cairo_surface_t **surface, std::string path_or_name
     search_icons(targets);
     pick_best(targets, size);
     for (const auto &item: targets[0].candidates) {
-        *surface = accelerated_surface(client->app, client, size, size);
-        if (*surface) {
-            paint_surface_with_image(*surface, item.full_path(), size, nullptr);
-            return true;
-        }
-        return false;
+        *surface = icon_load_async(client->app, client, item.full_path(), size);
+        return *surface != nullptr;
     }
     return false;
 }
@@ -1131,6 +1042,8 @@ void load_and_paint(App *app, AppClient *client, std::string path, int size, int
 
     for (auto o : once) {
         if (o->path == path && o->size == size) {
+            // Shared by every client, so each one painting it while it's loading has to be repainted once it's done
+            icon_load_notify(client, o->surface);
             paint_once(app, client, o, size, x, y);
             return;
         }
@@ -1139,8 +1052,8 @@ void load_and_paint(App *app, AppClient *client, std::string path, int size, int
     auto o = new OnceIcon();
     o->path = path;
     o->size = size;
-    o->surface = accelerated_surface(app, client, o->size, o->size);
-    o->success = paint_surface_with_image(o->surface, as_resource_path(o->path), o->size, nullptr);
+    o->surface = icon_load_async(app, client, as_resource_path(o->path), o->size);
+    o->success = o->surface != nullptr;
     once.push_back(o);
 
     paint_once(app, client, o, size, x, y);
@@ -21,6 +21,15 @@
 #include <pango/pangocairo.h>
 #include <vector>
 #include <optional>
+#include <list>
+#include <map>
+#include <climits>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
 #include <xcb/xcb_aux.h>
 #include <hsluv.h>
 #include <sys/stat.h>
@@ -32,6 +41,8 @@
 #include <fstream>
 #include "utility.h"
 #include "drawer.h"
+#include "icon_loader.h"
+#include "desktop_entry_cache.h"
 #include <xcb/xcb_cursor.h>
 #include <X11/cursorfont.h>
 
@@ -448,12 +459,13 @@ paint_item(AppClient *client, cairo_t *cr, Container *container) {
               container->real_bounds, 5, 44 * config->dpi);
     draw_clip_end(client);
     
-    if (data->launcher->icon_24__) {
-        int width = cairo_image_surface_get_width(data->launcher->icon_24__);
-        int height = cairo_image_surface_get_height(data->launcher->icon_24__);
+    gl_surface *gsurf = nullptr;
+    if (auto icon = launcher_icon(client, data->launcher, 24 * config->dpi, &gsurf)) {
+        int width = cairo_image_surface_get_width(icon);
+        int height = cairo_image_surface_get_height(icon);
         
-        draw_gl_texture(client, data->launcher->g24,
-                        data->launcher->icon_24__,
+        draw_gl_texture(client, gsurf,
+                        icon,
                                  (int) (container->real_bounds.x + 8 * config->dpi),
                                  (int) (container->real_bounds.y + container->real_bounds.h / 2 - height / 2));
     } else {
@@ -2539,6 +2551,86 @@ app_menu_closed(AppClient *client) {
 
 static std::mutex paint_mutex;
 
+// Guards Launcher::icon_path, which paint_desktop_files sets from its thread
+static std::mutex launcher_icon_path_mutex;
+
+struct LauncherIcon {
+    Launcher *launcher = nullptr;
+    int size = 0;
+    std::string path;
+    cairo_surface_t *surface = nullptr;
+    gl_surface *gsurf = nullptr;
+};
+
+// Most recently used first
+static std::list<LauncherIcon> launcher_icons;
+static std::map<std::pair<Launcher *, int>, std::list<LauncherIcon>::iterator> launcher_icons_index;
+static size_t launcher_icons_bytes = 0;
+// Enough for every launcher at the sizes the start menu and search results show them at (which grow with the dpi)
+static size_t launcher_icons_budget() {
+    return (size_t) (16 * 1024 * 1024 * std::max(1.0, config->dpi * config->dpi));
+}
+
+static size_t launcher_icon_bytes(cairo_surface_t *surface) {
+    return (size_t) cairo_image_surface_get_stride(surface) * cairo_image_surface_get_height(surface);
+}
+
+static void launcher_icon_drop(std::list<LauncherIcon>::iterator icon) {
+    launcher_icons_bytes -= launcher_icon_bytes(icon->surface);
+    cairo_surface_destroy(icon->surface);
+    delete icon->gsurf;
+    launcher_icons_index.erase({icon->launcher, icon->size});
+    launcher_icons.erase(icon);
+}
+
+cairo_surface_t *launcher_icon(AppClient *client, Launcher *launcher, int size, gl_surface **gsurf) {
+#ifdef TRACY_ENABLE
+    ZoneScoped;
+#endif
+    std::string path;
+    {
+        std::lock_guard lock(launcher_icon_path_mutex);
+        path = launcher->icon_path;
+    }
+    if (path.empty())
+        return nullptr;
+    
+    auto found = launcher_icons_index.find({launcher, size});
+    if (found != launcher_icons_index.end()) {
+        auto icon = found->second;
+        if (icon->path == path) {
+            launcher_icons.splice(launcher_icons.begin(), launcher_icons, icon);
+            *gsurf = icon->gsurf;
+            return icon->surface;
+        }
+        // The desktop file points at a different icon now
+        launcher_icon_drop(icon);
+    }
+    
+    auto surface = icon_load_async(client->app, client, path, size);
+    if (!surface)
+        return nullptr;
+    launcher_icons.push_front({launcher, size, path, surface, new gl_surface});
+    launcher_icons_index[{launcher, size}] = launcher_icons.begin();
+    launcher_icons_bytes += launcher_icon_bytes(surface);
+    while (launcher_icons_bytes > launcher_icons_budget() && launcher_icons.size() > 1)
+        launcher_icon_drop(std::prev(launcher_icons.end()));
+    *gsurf = launcher_icons.front().gsurf;
+    return surface;
+}
+
+void launcher_icon_forget(Launcher *launcher) {
+    auto it = launcher_icons_index.lower_bound({launcher, INT_MIN});
+    while (it != launcher_icons_index.end() && it->first.first == launcher) {
+        auto icon = it->second;
+        it++;
+        launcher_icon_drop(icon);
+    }
+}
+
+// Launchers whose icon paint_desktop_files still has to look up (guarded by paint_mutex)
+static std::vector<Launcher *> unresolved_launchers;
+
 static void
 paint_desktop_files() {
 #ifdef TRACY_ENABLE
@@ -2546,8 +2638,10 @@ paint_desktop_files() {
 #endif
     std::lock_guard m(paint_mutex); // No one is allowed to stop Winbar until this function finishes
     
+    std::vector<Launcher *> pending;
+    pending.swap(unresolved_launchers);
     std::vector<IconTarget> targets;
-    for (auto *launcher: launchers) {
+    for (auto *launcher: pending) {
         if (!launcher->icon.empty() && launcher->icon[0] != '/') {
             if (!has_options(launcher->icon))
                 launcher->icon = "";
@@ -2581,137 +2675,20 @@ paint_desktop_files() {
             if (!app->running)
                 return;
             auto launcher = (Launcher *) t.user_data;
-            launcher->icon_16__ = accelerated_surface(app, client_by_name(app, "taskbar"), 16 * config->dpi,
-                                                    16 * config->dpi);
-            launcher->icon_24__ = accelerated_surface(app, client_by_name(app, "taskbar"), 24 * config->dpi,
-                                                    24 * config->dpi);
-            launcher->icon_32__ = accelerated_surface(app, client_by_name(app, "taskbar"), 32 * config->dpi,
-                                                    32 * config->dpi);
-            launcher->icon_48__ = accelerated_surface(app, client_by_name(app, "taskbar"), 48 * config->dpi,
-                                                    48 * config->dpi);
-            launcher->icon_64__ = accelerated_surface(app, client_by_name(app, "taskbar"), 64 * config->dpi,
-                                                    64 * config->dpi);
-            
-            std::string path16;
-            std::string path24;
-            std::string path32;
-            std::string path48;
-            std::string path64;
-            
+            std::string path;
             if (!launcher->icon.empty()) {
                 if (launcher->icon[0] == '/') {
-                    path16 = launcher->icon;
-                    path24 = launcher->icon;
-                    path32 = launcher->icon;
-                    path48 = launcher->icon;
-                    path64 = launcher->icon;
-                } else {
-                    if (!t.candidates.empty()) {
-                        path16 = t.candidates[0].full_path();
-                        path24  = t.candidates[0].full_path();
-                        path32 = t.candidates[0].full_path();
-                        path48 = t.candidates[0].full_path();
-                        path64 = t.candidates[0].full_path();
-                    }
-//                    for (const auto &icon: t.candidates) {
-//                        if (!path16.empty() && !path24.empty() && !path32.empty() && !path48.empty() && !path64.empty())
-//                            break;
-//                        if ((icon.size == 16) && path16.empty()) {
-//                            path16 = icon.full_path();
-//                        } else if (icon.size == 24 && path24.empty()) {
-//                            path24 = icon.full_path();
-//                        } else if (icon.size == 32 && path32.empty()) {
-//                            path32 = icon.full_path();
-//                        } else if (icon.size == 48 && path48.empty()) {
-//                            path48 = icon.full_path();
-//                        } else if (icon.size == 64 && path64.empty()) {
-//                            path64 = icon.full_path();
-//                        }
-//                    }
-//                    for (const auto &icon: t.candidates) {
-//                        if (icon.extension == 2) {
-//                            if (path16.empty())
-//                                path16 = icon.full_path();
-//                            if (path24.empty())
-//                                path24 = icon.full_path();
-//                            if (path32.empty())
-//                                path32 = icon.full_path();
-//                            if (path48.empty())
-//                                path48 = icon.full_path();
-//                            if (path64.empty())
-//                                path64 = icon.full_path();
-//                            break;
-//                        }
-//                    }
-//                    for (const auto &icon: t.candidates) {
-//                        if (!path16.empty() && !path24.empty() && !path32.empty() && !path48.empty() && !path64.empty())
-//                            break;
-//                        if (path16.empty())
-//                            path16 = icon.full_path();
-//                        if (path24.empty())
-//                            path24 = icon.full_path();
-//                        if (path32.empty())
-//                            path32 = icon.full_path();
-//                        if (path48.empty())
-//                            path48 = icon.full_path();
-//                        if (path64.empty())
-//                            path64 = icon.full_path();
-//                    }
+                    path = launcher->icon;
+                } else if (!t.candidates.empty()) {
+                    path = t.candidates[0].full_path();
                 }
             }
-            
-            if (!path16.empty() && !launcher->icon.empty()) {
-                paint_surface_with_image(launcher->icon_16__, path16, 16 * config->dpi, nullptr);
-            } else {
-                paint_surface_with_image(
-                        launcher->icon_16__, as_resource_path("unknown-16.svg"), 16 * config->dpi, nullptr);
-            }
-            
-            if (!path24.empty() && !launcher->icon.empty()) {
-                paint_surface_with_image(launcher->icon_24__, path24, 24 * config->dpi, nullptr);
-            } else {
-                paint_surface_with_image(
-                        launcher->icon_24__, as_resource_path("unknown-24.svg"), 24 * config->dpi, nullptr);
-            }
-            
-            if (!path32.empty() && !launcher->icon.empty()) {
-                paint_surface_with_image(launcher->icon_32__, path32, 32 * config->dpi, nullptr);
-            } else {
-                paint_surface_with_image(
-                        launcher->icon_32__, as_resource_path("unknown-32.svg"), 32 * config->dpi, nullptr);
-            }
-            
-            if (!path48.empty() && !launcher->icon.empty()) {
-                paint_surface_with_image(launcher->icon_48__, path48, 48 * config->dpi, nullptr);
-            } else {
-                paint_surface_with_image(
-                        launcher->icon_48__, as_resource_path("unknown-32.svg"), 48 * config->dpi, nullptr);
-            }
-            
-            if (!path64.empty() && !launcher->icon.empty()) {
-                paint_surface_with_image(launcher->icon_64__, path64, 64 * config->dpi, nullptr);
-            } else {
-                paint_surface_with_image(
-                        launcher->icon_64__, as_resource_path("unknown-64.svg"), 64 * config->dpi, nullptr);
-            }
+            std::lock_guard lock(launcher_icon_path_mutex);
+            launcher->icon_path = path;
         }
     }
 }
 
-static std::optional<int> ends_with(const char *str, const char *suffix) {
-    if (!str || !suffix)
-        return {};
-    size_t lenstr = strlen(str);
-    size_t lensuffix = strlen(suffix);
-    if (lensuffix > lenstr)
-        return {};
-    bool b = strncmp(str + lenstr - lensuffix, suffix, lensuffix) == 0;
-    if (!b) {
-        return {};
-    }
-    return lenstr - lensuffix;
-}
-
 void eraseAllSubStr(std::string &mainStr, const std::string &toErase) {
     size_t pos = std::string::npos;
     while ((pos = mainStr.find(toErase)) != std::string::npos) {
@@ -2723,215 +2700,394 @@ void eraseSubStrings(std::string &mainStr, const std::vector<std::string> &strLi
     std::for_each(strList.begin(), strList.end(), std::bind(eraseAllSubStr, std::ref(mainStr), std::placeholders::_1));
 }
 
-void load_desktop_files(std::string directory) {
-    auto c = getenv("XDG_CURRENT_DESKTOP");
-    std::string paths;
-    if (c) paths = std::string(c);
-    std::stringstream input(paths);
+// If the launcher for entry should be in the start menu
+static bool desktop_entry_shown(const DesktopEntry &entry, const std::vector<std::string> &current_desktop) {
+    if (!entry.parsed)
+        return false;
     std::string parsed;
-    std::vector<std::string> current_desktop;
-    if (getline(input, parsed, ';')) {
-        current_desktop.push_back(parsed);
+    const std::string &path = entry.path;
+    std::string filename = path.substr(path.find_last_of('/') + 1);
+    
+    const std::string &exec = entry.get(DesktopExec);
+    const std::string &keywords = entry.get(DesktopKeywords);
+    std::string no_display_text = entry.get(DesktopNoDisplay);
+    const std::string &not_show_in = entry.get(DesktopNotShowIn);
+    const std::string &only_show_in = entry.get(DesktopOnlyShowIn);
+    bool no_display = false;
+    std::transform(no_display_text.begin(), no_display_text.end(), no_display_text.begin(), ::tolower);
+    
+    if (no_display_text == "true") {
+        if (app->on_kde) {
+            no_display = !starts_with(filename, "kcm_");
+        } else {
+            no_display = true;
+        }
     }
     
-    if (!directory.empty())
-        if (directory[directory.size() - 1] != '/')
-            directory += '/';
-    try {
-        for (const auto &entry: std::filesystem::recursive_directory_iterator(directory,
-                                                                              std::filesystem::directory_options::follow_directory_symlink)) {
-            if (!entry.is_regular_file())
-                continue;
-            
-            const std::string &filename = entry.path().filename().string();
-            if (!ends_with(filename.c_str(), ".desktop")) {
-                continue;
-            }
-            std::string path = entry.path().string();
-
-            // Parse desktop file
-            INIReader desktop_application(path);
-            if (desktop_application.ParseError() != 0) {
-                continue;
-            }
-            
-            std::string name = desktop_application.Get("Desktop Entry", "Name", "");
-            std::string wmclass = desktop_application.Get("Desktop Entry", "StartupWMClass", "");
-            std::string exec = desktop_application.Get("Desktop Entry", "Exec", "");
-            std::string keywords = desktop_application.Get("Desktop Entry", "Keywords", "");
-            std::string categories = desktop_application.Get("Desktop Entry", "Categories", "");
-            std::string generic_name = desktop_application.Get("Desktop Entry", "GenericName", "");
-            std::string icon = desktop_application.Get("Desktop Entry", "Icon", "");
-            std::string no_display_text = desktop_application.Get("Desktop Entry", "NoDisplay", "");
-            std::string not_show_in = desktop_application.Get("Desktop Entry", "NotShowIn", "");
-            std::string only_show_in = desktop_application.Get("Desktop Entry", "OnlyShowIn", "");
-            bool no_display = false;
-            std::transform(no_display_text.begin(), no_display_text.end(), no_display_text.begin(), ::tolower);
-            
-            if (no_display_text == "true") {
-                if (app->on_kde) {
-                    no_display = !starts_with(filename, "kcm_");
-                } else {
-                    no_display = true;
-                }
-            }
-            
-            if (exec.empty() || no_display || keywords.find("lsp-plugins") !=
-                                              std::string::npos) // If we find no exec entry then there's nothing to run
-                continue;
-            
-            if (!current_desktop.empty() && !winbar_settings->ignore_only_show_in) {
-                if (!only_show_in.empty()) {
-                    std::stringstream only_input(only_show_in);
-                    bool found = false;
-                    if (getline(only_input, parsed, ';')) {
-                        for (const auto &s: current_desktop) {
-                            if (s == parsed)
-                                found = true;
-                        }
-                    }
-                    if (!found)
-                        continue;
-                } else if (!not_show_in.empty()) {
-                    std::stringstream not_input(not_show_in);
-                    bool found = false;
-                    if (getline(not_input, parsed, ';')) {
-                        for (const auto &s: current_desktop) {
-                            if (s == parsed)
-                                found = true;
-                        }
-                    }
-                    if (found)
-                        continue;
+    if (exec.empty() || no_display || keywords.find("lsp-plugins") !=
+                                      std::string::npos) // If we find no exec entry then there's nothing to run
+        return false;
+    
+    if (!current_desktop.empty() && !winbar_settings->ignore_only_show_in) {
+        if (!only_show_in.empty()) {
+            std::stringstream only_input(only_show_in);
+            bool found = false;
+            if (getline(only_input, parsed, ';')) {
+                for (const auto &s: current_desktop) {
+                    if (s == parsed)
+                        found = true;
                 }
             }
-            
-            // Remove all field codes
-            // https://specifications.freedesktop.org/desktop-entry-spec/desktop-entry-spec-latest.html#exec-variables
-            eraseSubStrings(exec, {"%f", "%F", "%u", "%U", "%d", "%D", "%n", "%N", "%i", "%c", "%k", "%v", "%m"});
-            
-            if (name.empty())// If no name was set, just give it the exec name
-                name = exec;
-            
-            auto *launcher = new Launcher();
-            launcher->full_path = path;
-            launcher->name = name;
-            launcher->lowercase_name = launcher->name;
-            if (!keywords.empty()) {
-                std::stringstream ss(keywords);
-                std::string item;
-                while (std::getline(ss, item, ';')) {
-                    if (!item.empty()) { // Skip empty tokens if any
-                        std::transform(item.begin(), item.end(), item.begin(),
-                                       [](unsigned char c) { return std::tolower(c); });
-                        launcher->keywords.push_back(item);
-                    }
+            if (!found)
+                return false;
+        } else if (!not_show_in.empty()) {
+            std::stringstream not_input(not_show_in);
+            bool found = false;
+            if (getline(not_input, parsed, ';')) {
+                for (const auto &s: current_desktop) {
+                    if (s == parsed)
+                        found = true;
                 }
             }
-            if (!categories.empty()) {
-                std::stringstream ss(categories);
-                std::string item;
-                while (std::getline(ss, item, ';')) {
-                    if (!item.empty()) { // Skip empty tokens if any
-                        std::transform(item.begin(), item.end(), item.begin(),
-                                       [](unsigned char c) { return std::tolower(c); });
-                        launcher->categories.push_back(item);
-                    }
-                }
+            if (found)
+                return false;
+        }
+    }
+    return true;
+}
+
+// Sets everything in launcher that comes from entry (replacing what was there if the file changed)
+static void fill_launcher(Launcher *launcher, const DesktopEntry &entry) {
+    std::string name = entry.get(DesktopName);
+    std::string exec = entry.get(DesktopExec);
+    const std::string &keywords = entry.get(DesktopKeywords);
+    const std::string &categories = entry.get(DesktopCategories);
+    std::string generic_name = entry.get(DesktopGenericName);
+    
+    // Remove all field codes
+    // https://specifications.freedesktop.org/desktop-entry-spec/desktop-entry-spec-latest.html#exec-variables
+    eraseSubStrings(exec, {"%f", "%F", "%u", "%U", "%d", "%D", "%n", "%N", "%i", "%c", "%k", "%v", "%m"});
+    
+    if (name.empty())// If no name was set, just give it the exec name
+        name = exec;
+    
+    launcher->full_path = entry.path;
+    launcher->name = name;
+    launcher->lowercase_name = launcher->name;
+    launcher->keywords.clear();
+    if (!keywords.empty()) {
+        std::stringstream ss(keywords);
+        std::string item;
+        while (std::getline(ss, item, ';')) {
+            if (!item.empty()) { // Skip empty tokens if any
+                std::transform(item.begin(), item.end(), item.begin(),
+                               [](unsigned char c) { return std::tolower(c); });
+                launcher->keywords.push_back(item);
             }
-            if (!generic_name.empty()) {
-                std::transform(generic_name.begin(), generic_name.end(), generic_name.begin(),
+        }
+    }
+    launcher->categories.clear();
+    if (!categories.empty()) {
+        std::stringstream ss(categories);
+        std::string item;
+        while (std::getline(ss, item, ';')) {
+            if (!item.empty()) { // Skip empty tokens if any
+                std::transform(item.begin(), item.end(), item.begin(),
                                [](unsigned char c) { return std::tolower(c); });
-                launcher->generic_name = generic_name;
+                launcher->categories.push_back(item);
             }
-            
-            std::transform(launcher->lowercase_name.begin(),
-                           launcher->lowercase_name.end(),
-                           launcher->lowercase_name.begin(),
-                           ::tolower);
-            launcher->exec = exec;
-            launcher->wmclass = wmclass;
-            launcher->launcher_name = name;
-            launcher->icon = icon;
-            struct stat buffer{};
-            if (stat(path.c_str(), &buffer) != 0) {
-                delete launcher;
+        }
+    }
+    std::transform(generic_name.begin(), generic_name.end(), generic_name.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    launcher->generic_name = generic_name;
+    
+    std::transform(launcher->lowercase_name.begin(),
+                   launcher->lowercase_name.end(),
+                   launcher->lowercase_name.begin(),
+                   ::tolower);
+    launcher->exec = exec;
+    launcher->wmclass = entry.get(DesktopStartupWMClass);
+    launcher->launcher_name = name;
+    launcher->icon = entry.get(DesktopIcon);
+    launcher->time_modified = entry.mtime.tv_sec;
+    launcher->desktop_file_mtime = entry.mtime;
+    launcher->desktop_file_size = entry.size;
+}
+
+static int launcher_menu_priority(const Launcher *l, time_t now) {
+    auto recently_added_threshold = 86400 * 2; // two days  in seconds
+    double diff = difftime(now, l->time_modified);
+    if (diff < recently_added_threshold) { // less than two days old
+        return 1;
+    } else if (!l->name.empty()) {
+        if (!isalnum(l->name[0])) { // is symbol
+            return 2;
+        } else if (isdigit(l->name[0])) { // is number
+            return 3;
+        } else { // is ascii
+            return 4;
+        }
+    }
+    return 0;
+}
+
+// TODO: sort in order latest, &, #, A...Z
+static bool launcher_comes_before(const Launcher *lhs, const Launcher *rhs) {
+    if (lhs->app_menu_priority == rhs->app_menu_priority) {
+        if (lhs->app_menu_priority == 1) { // time based
+            return lhs->time_modified > rhs->time_modified;
+        }
+        
+        // alphabetical order
+        return lhs->lowercase_name < rhs->lowercase_name;
+    } else {
+        return lhs->app_menu_priority < rhs->app_menu_priority;
+    }
+}
+
+// A folder .desktop files are read from, or (for a directory that doesn't exist yet) the closest folder above it that
+// does, waiting for the next folder on the way to it to show up
+struct DesktopFolderWatch {
+    std::string path;
+    bool has_desktop_files = false;
+    std::set<std::string> awaited;
+};
+
+static int desktop_inotify_fd = -1;
+static std::map<int, DesktopFolderWatch> desktop_folder_watches;
+static Timeout *desktop_update_timeout = nullptr;
+
+static void desktop_files_settled(App *app, AppClient *, Timeout *timeout, void *) {
+    // Search results and live tiles point at launchers, so they aren't touched while those are open
+    timeout->keep_running = client_by_name(app, "app_menu") || client_by_name(app, "search_menu");
+    if (timeout->keep_running)
+        return;
+    desktop_update_timeout = nullptr;
+    load_all_desktop_files();
+    load_live_tiles();
+}
+
+static void desktop_folders_changed(App *app, int fd, void *) {
+    char buf[4096]
+            __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *event;
+    ssize_t len;
+    bool changed = false;
+    while ((len = read(fd, buf, sizeof(buf))) > 0) {
+        for (char *ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + event->len) {
+            event = (const struct inotify_event *) ptr;
+            if (event->mask & IN_Q_OVERFLOW) {
+                changed = true;
                 continue;
             }
-            launcher->time_modified = buffer.st_mtim.tv_sec;
-            
-            launchers.push_back(launcher);
+            auto found = desktop_folder_watches.find(event->wd);
+            if (found == desktop_folder_watches.end())
+                continue;
+            const auto &watch = found->second;
+            if (event->len == 0) {
+                // The folder itself was removed or moved
+                changed = changed || watch.has_desktop_files;
+                if (event->mask & IN_IGNORED)
+                    desktop_folder_watches.erase(found);
+                continue;
+            }
+            std::string_view name(event->name);
+            if (watch.awaited.count(std::string(name))) {
+                changed = true;
+            } else if (watch.has_desktop_files) {
+                if ((event->mask & IN_ISDIR) ||
+                    (name.size() > 8 && name.compare(name.size() - 8, 8, ".desktop") == 0))
+                    changed = true;
+            }
         }
-    } catch (const std::filesystem::filesystem_error &e) {
+    }
     
+    if (!changed)
+        return;
+    // Installing a package writes its files one after another, so wait for things to settle down first
+    if (desktop_update_timeout == nullptr) {
+        desktop_update_timeout = app_timeout_create(app, nullptr, 1000, desktop_files_settled, nullptr,
+                                                    const_cast<char *>(__PRETTY_FUNCTION__));
+    } else {
+        app_timeout_replace(app, nullptr, desktop_update_timeout, 1000, desktop_files_settled, nullptr);
     }
 }
 
-void load_all_desktop_files() {
+// Watches every folder in folders, and the closest existing parent of every directory that doesn't exist
+static void watch_desktop_folders(const std::vector<std::string> &directories, const std::vector<std::string> &folders) {
 #ifdef TRACY_ENABLE
     ZoneScoped;
 #endif
-    std::lock_guard m(paint_mutex); // No one is allowed to stop Winbar until this function finishes
+    if (desktop_inotify_fd == -1) {
+        desktop_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (desktop_inotify_fd == -1)
+            return;
+        poll_descriptor(app, desktop_inotify_fd, EPOLLIN, desktop_folders_changed, nullptr, "Desktop file changes");
+    }
     
-    for (auto *l: launchers) {
-        delete l;
+    // Watching a folder twice gives back the same descriptor, so this is also how duplicates get merged
+    std::map<int, DesktopFolderWatch> watches;
+    for (const auto &folder: folders) {
+        int wd = inotify_add_watch(desktop_inotify_fd, folder.c_str(),
+                                   IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE |
+                                   IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+        if (wd == -1)
+            continue;
+        watches[wd].path = folder;
+        watches[wd].has_desktop_files = true;
+    }
+    for (const auto &directory: directories) {
+        std::string path = directory;
+        while (path.size() > 1 && path[path.size() - 1] == '/')
+            path.pop_back();
+        struct stat info{};
+        if (path.empty() || stat(path.c_str(), &info) == 0)
+            continue;
+        while (path.find('/') != std::string::npos) {
+            auto slash = path.find_last_of('/');
+            std::string name = path.substr(slash + 1);
+            path = slash == 0 ? "/" : path.substr(0, slash);
+            if (stat(path.c_str(), &info) != 0)
+                continue;
+            // IN_MASK_ADD so that if it's also a folder with .desktop files in it, those events aren't lost
+            int wd = inotify_add_watch(desktop_inotify_fd, path.c_str(),
+                                       IN_CREATE | IN_MOVED_TO | IN_ONLYDIR | IN_MASK_ADD);
+            if (wd != -1) {
+                watches[wd].path = path;
+                watches[wd].awaited.insert(name);
+            }
+            break;
+        }
     }
-    launchers.clear();
-    launchers.shrink_to_fit();
+    
+    for (const auto &[wd, watch]: desktop_folder_watches)
+        if (!watches.count(wd))
+            inotify_rm_watch(desktop_inotify_fd, wd);
+    desktop_folder_watches = std::move(watches);
+}
+
+// Brings launchers up to date with the .desktop files. Launchers whose file didn't change are left alone (keeping their
+// icons and their place in the list), changed ones are updated in place and re-sorted, and only new or changed ones get
+// their icon looked up again.
+void load_all_desktop_files() {
+#ifdef TRACY_ENABLE
+    ZoneScoped;
+#endif
+    std::lock_guard m(paint_mutex); // No one is allowed to stop Winbar until this function finishes
     
     std::string local_desktop_files = getenv("HOME");
     local_desktop_files += "/.local/share/applications/";
     std::string local_flatpak_files = getenv("HOME");
     local_flatpak_files += "/.local/share/flatpak/exports/share/applications/";
     
+    std::vector<std::string> directories;
     if (!winbar_settings->custom_desktops_directory.empty())
-        load_desktop_files(winbar_settings->custom_desktops_directory);
-    if (winbar_settings->custom_desktops_directory_exclusive)
-        goto skip;
-    load_desktop_files("/usr/share/applications/");
-    load_desktop_files(local_desktop_files);
-    load_desktop_files("/var/lib/flatpak/exports/share/applications/");
-    load_desktop_files(local_flatpak_files);
-    skip:
+        directories.push_back(winbar_settings->custom_desktops_directory);
+    if (!winbar_settings->custom_desktops_directory_exclusive) {
+        directories.emplace_back("/usr/share/applications/");
+        directories.push_back(local_desktop_files);
+        directories.emplace_back("/var/lib/flatpak/exports/share/applications/");
+        directories.push_back(local_flatpak_files);
+    }
+    
+    // Only the .desktop files that changed since last time are actually read
+    std::vector<DesktopEntry> entries;
+    std::vector<std::string> folders;
+    desktop_entries_load(directories, entries, &folders);
+    watch_desktop_folders(directories, folders);
+    
+    auto c = getenv("XDG_CURRENT_DESKTOP");
+    std::string paths;
+    if (c) paths = std::string(c);
+    std::stringstream input(paths);
+    std::string parsed;
+    std::vector<std::string> current_desktop;
+    if (getline(input, parsed, ';')) {
+        current_desktop.push_back(parsed);
+    }
+    
+    std::unordered_multimap<std::string, Launcher *> previous;
+    for (auto *l: launchers)
+        previous.emplace(l->full_path, l);
     
     time_t now;
     time(&now);
     
-    auto recently_added_threshold = 86400 * 2; // two days  in seconds
-    for (auto l: launchers) {
-        double diff = difftime(now, l->time_modified);
-        if (diff < recently_added_threshold) { // less than two days old
-            l->app_menu_priority = 1;
-        } else if (!l->name.empty()) {
-            if (!isalnum(l->name[0])) { // is symbol
-                l->app_menu_priority = 2;
-            } else if (isdigit(l->name[0])) { // is number
-                l->app_menu_priority = 3;
-            } else { // is ascii
-                l->app_menu_priority = 4;
-            }
+    // Launchers that are new, or whose place in the sorted list might have changed
+    std::vector<Launcher *> moved;
+    std::unordered_set<Launcher *> moved_set;
+    for (const auto &entry: entries) {
+        if (!desktop_entry_shown(entry, current_desktop))
+            continue;
+        Launcher *launcher;
+        bool changed = true;
+        auto found = previous.find(entry.path);
+        if (found != previous.end()) {
+            launcher = found->second;
+            previous.erase(found);
+            changed = launcher->desktop_file_mtime.tv_sec != entry.mtime.tv_sec ||
+                      launcher->desktop_file_mtime.tv_nsec != entry.mtime.tv_nsec ||
+                      launcher->desktop_file_size != entry.size;
+        } else {
+            launcher = new Launcher();
+        }
+        if (changed) {
+            fill_launcher(launcher, entry);
+            unresolved_launchers.push_back(launcher);
+        }
+        // Also changes once something stops counting as recently added
+        int priority = launcher_menu_priority(launcher, now);
+        if (changed || priority != launcher->app_menu_priority) {
+            launcher->app_menu_priority = priority;
+            moved.push_back(launcher);
+            moved_set.insert(launcher);
         }
     }
     
-    // TODO: sort in order latest, &, #, A...Z
-    std::sort(launchers.begin(), launchers.end(), [](const auto &lhs, const auto &rhs) {
-        if (lhs->app_menu_priority == rhs->app_menu_priority) {
-            if (lhs->app_menu_priority == 1) { // time based
-                return lhs->time_modified > rhs->time_modified;
-            }
-            
-            // alphabetical order
-            std::string first_name = lhs->name;
-            std::string second_name = rhs->name;
-            std::for_each(first_name.begin(), first_name.end(), [](char &c) { c = std::tolower(c); });
-            std::for_each(second_name.begin(), second_name.end(), [](char &c) { c = std::tolower(c); });
-            
-            return first_name < second_name;
-        } else {
-            return lhs->app_menu_priority < rhs->app_menu_priority;
-        }
-    });
-    std::thread(paint_desktop_files).detach();
+    // Whatever wasn't matched up with a file is gone or hidden now
+    std::unordered_set<Launcher *> removed;
+    for (const auto &[path, l]: previous)
+        removed.insert(l);
+    launchers.erase(std::remove_if(launchers.begin(), launchers.end(), [&](Launcher *l) {
+        return moved_set.count(l) || removed.count(l);
+    }), launchers.end());
+    if (!removed.empty()) {
+        unresolved_launchers.erase(std::remove_if(unresolved_launchers.begin(), unresolved_launchers.end(),
+                                                  [&removed](Launcher *l) { return removed.count(l) != 0; }),
+                                   unresolved_launchers.end());
+        for (auto l: removed)
+            delete l;
+    }
+    
+    // What's left is still in order, so a few launchers can just be put in their spot
+    if (moved.size() * 8 > launchers.size()) {
+        launchers.insert(launchers.end(), moved.begin(), moved.end());
+        std::sort(launchers.begin(), launchers.end(), launcher_comes_before);
+    } else {
+        for (auto l: moved)
+            launchers.insert(std::upper_bound(launchers.begin(), launchers.end(), l, launcher_comes_before), l);
+    }
+    
+    if (!unresolved_launchers.empty())
+        std::thread(paint_desktop_files).detach();
+}
+
+void unload_all_desktop_files() {
+    std::lock_guard m(paint_mutex);
+    for (auto l: launchers) {
+        delete l;
+    }
+    launchers.clear();
+    launchers.shrink_to_fit();
+    unresolved_launchers.clear();
+    
+    if (desktop_inotify_fd != -1)
+        close(desktop_inotify_fd);
+    desktop_inotify_fd = -1;
+    desktop_folder_watches.clear();
+    // The timeout itself went away with the App
+    desktop_update_timeout = nullptr;
 }
 
 void start_app_menu(bool autoclose) {
@@ -7,8 +7,10 @@
 #include "taskbar.h"
 
 #include <cairo.h>
+#include <ctime>
 #include <string>
 #include <vector>
+#include <sys/types.h>
 
 class PinInfo {
 public:
@@ -19,6 +21,11 @@ public:
     int y = -1; // -1 means it needs to be positioned
 };
 
+class Launcher;
+
+// Drops every surface launcher_icon made for launcher.
+void launcher_icon_forget(Launcher *launcher);
+
 class Launcher : public Sortable {
 public:
     std::string full_path;
@@ -27,23 +34,14 @@ public:
     std::string wmclass;
     std::string launcher_name;
     
-    // TODO: gl_surfaces are only valid for their respective clients, not across client
-    cairo_surface_t *icon_16__ = nullptr;
-    gl_surface *g16 = new gl_surface;
-    
-    cairo_surface_t *icon_32__ = nullptr;
-    gl_surface *g32 = new gl_surface;
-    
-    cairo_surface_t *icon_24__ = nullptr;
-    gl_surface *g24 = new gl_surface;
+    // Full path of the icon file, set once paint_desktop_files has looked it up (empty means use the unknown icon).
+    // Surfaces of it are made on demand by launcher_icon.
+    std::string icon_path;
     
-    cairo_surface_t *icon_48__ = nullptr;
-    gl_surface *g48 = new gl_surface;
-    
-    cairo_surface_t *icon_64__ = nullptr;
-    gl_surface *g64 = new gl_surface;
-
     time_t time_modified = 0;
+    // Of the .desktop file when it was last read, to tell if it changed
+    struct timespec desktop_file_mtime = {};
+    off_t desktop_file_size = 0;
     int priority = 0;
     
     int app_menu_priority = 0;
@@ -51,16 +49,7 @@ public:
     double move_after_drag_y = 0;
     
     ~Launcher() {
-        if (icon_16__)
-            cairo_surface_destroy(icon_16__);
-        if (icon_32__)
-            cairo_surface_destroy(icon_32__);
-        if (icon_24__)
-            cairo_surface_destroy(icon_24__);
-        if (icon_48__)
-            cairo_surface_destroy(icon_48__);
-        if (icon_64__)
-            cairo_surface_destroy(icon_64__);
+        launcher_icon_forget(this);
     }
     
     void set_pinned(bool pinned) {
@@ -79,10 +68,19 @@ private:
 
 extern std::vector<Launcher *> launchers;
 
+// The icon of launcher at size x size, or nullptr if it doesn't have one (yet), in which case the unknown icon should be
+// drawn. Surfaces are made the first time a size is asked for and kept in an LRU shared by all launchers (bounded by
+// memory, not count), together with the gl_surface for them which is put in gsurf. Only valid until the next call.
+cairo_surface_t *launcher_icon(AppClient *client, Launcher *launcher, int size, gl_surface **gsurf);
+
 void start_app_menu(bool autoclose = false);
 
+// Reads the .desktop files into launchers (only the ones that changed if it was already done), and watches their folders
+// so it's done again by itself when they change.
 void load_all_desktop_files();
 
+void unload_all_desktop_files();
+
 void save_live_tiles();
 
 void load_live_tiles();
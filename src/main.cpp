@@ -22,6 +22,8 @@
 #include "dpi.h"
 #include "volume_menu.h"
 #include "settings_menu.h"
+#include "renderer_calibration.h"
+#include "icon_pixmap_cache.h"
 
 App *app;
 
@@ -168,6 +170,9 @@ int main_actual(int argc, char *argv[]) {
     
     load_in_fonts();
     
+    // Has to happen before any client is created since it decides which backend they'll paint with
+    renderer_calibrate(app);
+    
     set_icons_path_and_possibly_update(app);
     
     // Add listeners and grabs on the root window
@@ -216,6 +221,8 @@ int main_actual(int argc, char *argv[]) {
     
     free_slept();
     
+    icon_pixmap_cache_flush();
+    
     unload_icons();
     
     // Clean up
@@ -225,11 +232,7 @@ int main_actual(int argc, char *argv[]) {
     
     wifi_stop();
     
-    for (auto l: launchers) {
-        delete l;
-    }
-    launchers.clear();
-    launchers.shrink_to_fit();
+    unload_all_desktop_files();
     
     delete global;
     
@@ -318,15 +318,19 @@ static void clicked_save_and_quit(AppClient *client, cairo_t *cr, Container *con
                 if (!path.empty()) {
                     auto *data = (LaunchableButton *) pinned_icon_data;
                     load_icon_full_path(app, taskbar, &data->surface__, path, 24 * config->dpi);
+                    data->surface_path = path;
                     found = true;
                     break;
                 }
             }
             if (!found) {
                 pinned_icon_data->surface__ = accelerated_surface(app, client, 24 * config->dpi, 24 * config->dpi);
-                paint_surface_with_image(pinned_icon_data->surface__, as_resource_path("unknown-24.svg"),
+                pinned_icon_data->surface_path = as_resource_path("unknown-24.svg");
+                paint_surface_with_image(pinned_icon_data->surface__, pinned_icon_data->surface_path,
                                          24 * config->dpi, nullptr);
             }
+            // The accent color was worked out from the old icon
+            pinned_icon_data->average_color_set = false;
         }
     }
     client_close_threaded(client->app, client);
@@ -421,7 +425,7 @@ static void
 show_icon_options() {
     auto c = client_by_name(app, "pinned_icon_editor");
     
-    std::vector<std::string_view> names;
+    std::vector<std::string> names;
     auto *field = container_by_name("icon_name_field", c->root);
     std::string &target = ((TextAreaData *) field->user_data)->state->text;
     if (!target.empty()) {
@@ -496,8 +500,8 @@ show_icon_options() {
         std::string &target = ((TextAreaData *) field->user_data)->state->text;
         if (!target.empty()) {
             std::vector<IconTarget> targets;
-            for (auto view: names) {
-                targets.emplace_back(std::string(view));
+            for (const auto &name: names) {
+                targets.emplace_back(name);
             }
             search_icons(targets);
             
@@ -506,15 +510,15 @@ show_icon_options() {
                 for (int i = 0; i < targets.size(); i++) {
                     auto t = targets[i];
                     for (const auto &item: t.candidates) {
-                        if (std::find(no_dups.begin(), no_dups.end(), item.filename) == no_dups.end()) {
-                            no_dups.push_back(item.filename); // Add value if not found
+                        if (std::find(no_dups.begin(), no_dups.end(), item.filename()) == no_dups.end()) {
+                            no_dups.emplace_back(item.filename()); // Add value if not found
                         }
                     }
                 }
                 for (int i = 0; i < targets.size(); i++) {
                     auto t = targets[i];
                     for (const auto &item: t.candidates) {
-                        std::string fullname = ":" + item.theme + ":" + item.filename;
+                        std::string fullname = ":" + std::string(item.theme()) + ":" + std::string(item.filename());
                         if (std::find(no_dups.begin(), no_dups.end(), fullname) == no_dups.end()) {
                             no_dups.push_back(fullname); // Add value if not found
                         }
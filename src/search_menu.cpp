@@ -198,9 +198,10 @@ paint_item(AppClient *client, cairo_t *cr, Container *container) {
         }
     } else if (active_tab == "Apps") {
         auto *l_data = (Launcher *) data->user_data;
-        if (l_data->icon_16__) {
-            draw_gl_texture(client, l_data->g16,
-                                    l_data->icon_16__,
+        gl_surface *gsurf = nullptr;
+        if (auto icon = launcher_icon(client, l_data, 16 * config->dpi, &gsurf)) {
+            draw_gl_texture(client, gsurf,
+                                    icon,
                                     container->real_bounds.x + 12 * config->dpi,
                                     container->real_bounds.y + container->real_bounds.h / 2 - 8 * config->dpi);
         } else {
@@ -235,9 +236,10 @@ paint_top_item(AppClient *client, cairo_t *cr, Container *container) {
         }
     } else if (active_tab == "Apps") {
         auto *l_data = (Launcher *) data->user_data;
-        if (l_data->icon_32__) {
-            draw_gl_texture(client, l_data->g32,
-                                    l_data->icon_32__,
+        gl_surface *gsurf = nullptr;
+        if (auto icon = launcher_icon(client, l_data, 32 * config->dpi, &gsurf)) {
+            draw_gl_texture(client, gsurf,
+                                    icon,
                                     container->real_bounds.x + 12 * config->dpi,
                                     container->real_bounds.y + container->real_bounds.h / 2 - 16 * config->dpi);
         } else {
@@ -323,9 +325,10 @@ paint_right_active_title(AppClient *client, cairo_t *cr, Container *container) {
         }
     } else if (active_tab == "Apps") {
         auto *l_data = (Launcher *) data->user_data;
-        if (l_data->icon_64__) {
-            draw_gl_texture(client, l_data->g64,
-                                     l_data->icon_64__,
+        gl_surface *gsurf = nullptr;
+        if (auto icon = launcher_icon(client, l_data, 64 * config->dpi, &gsurf)) {
+            draw_gl_texture(client, gsurf,
+                                     icon,
                                      container->real_bounds.x + container->real_bounds.w / 2 - 32 * config->dpi,
                                      container->real_bounds.y + 21 * config->dpi);
         } else {
@@ -950,6 +953,62 @@ compare_priority(Sortable *first, Sortable *second) {
     return first->name.length() < second->name.length();
 }
 
+// Bumped whenever the launchers or scripts may have changed, so sort_and_add builds its index again
+static int search_index_generation = 0;
+
+// The text sort_and_add matches against for one kind of sortable, lowercased and packed into one buffer, plus what the
+// last search matched so the next keystroke only has to look at those
+struct SearchIndex {
+    int generation = -1;
+    std::vector<Sortable *> sortables;
+    // Every field of every sortable, lowercased, each one followed by a '\0'
+    std::string text;
+    // The fields of sortables[i] are the ones from first_field[i] up to first_field[i + 1] (name, generic name,
+    // keywords, categories)
+    std::vector<uint32_t> first_field;
+    std::vector<uint32_t> field_offsets;
+    std::vector<uint32_t> field_lengths;
+    // fts::fuzzy_char_mask of each field
+    std::vector<uint64_t> field_masks;
+    // The original of each field, since case matters when scoring
+    std::vector<const std::string *> field_strings;
+    std::vector<uint8_t> field_match_levels;
+    
+    std::string query; // Lowercased
+    std::vector<uint32_t> matches; // Indexes into sortables, in order
+};
+
+template<class T>
+static void search_index_build(SearchIndex *index, const std::vector<T> &sortables) {
+#ifdef TRACY_ENABLE
+    ZoneScoped;
+#endif
+    *index = SearchIndex();
+    index->generation = search_index_generation;
+    auto add_field = [index](const std::string &field, uint8_t match_level) {
+        index->field_offsets.push_back(index->text.size());
+        index->field_lengths.push_back(field.size());
+        index->field_masks.push_back(fts::fuzzy_char_mask(field.data(), field.size()));
+        index->field_strings.push_back(&field);
+        index->field_match_levels.push_back(match_level);
+        for (char c: field)
+            index->text += (char) tolower((unsigned char) c);
+        index->text += '\0';
+    };
+    for (Sortable *s: sortables) {
+        index->sortables.push_back(s);
+        index->first_field.push_back(index->field_offsets.size());
+        add_field(s->name, 0);
+        if (!s->generic_name.empty())
+            add_field(s->generic_name, 0);
+        for (const auto &k: s->keywords)
+            add_field(k, 100);
+        for (const auto &k: s->categories)
+            add_field(k, 100);
+    }
+    index->first_field.push_back(index->field_offsets.size());
+}
+
 static bool can_pop = false;
 
 template<class T>
@@ -957,65 +1016,91 @@ void sort_and_add(std::vector<T> *sortables,
                   Container *bottom,
                   std::string text,
                   const std::vector<HistoricalNameUsed *> &history) {
-    std::vector<T> sorted;
-    for (int i = 0; i < sortables->size(); i++) {
-        Sortable *s = (*sortables)[i];
+    static SearchIndex index;
+    bool same_sortables = index.generation == search_index_generation && index.sortables.size() == sortables->size() &&
+                          std::equal(sortables->begin(), sortables->end(), index.sortables.begin());
+    if (!same_sortables)
+        search_index_build(&index, *sortables);
+    
+    std::string query = text;
+    std::transform(query.begin(), query.end(), query.begin(), [](unsigned char c) { return (char) tolower(c); });
+    // Anything that matches a longer query also matched the shorter one, so only those need to be looked at again
+    std::vector<uint32_t> candidates;
+    if (same_sortables && !index.query.empty() && query.compare(0, index.query.size(), index.query) == 0) {
+        candidates.swap(index.matches);
+    } else {
+        candidates.resize(index.sortables.size());
+        for (uint32_t i = 0; i < candidates.size(); i++)
+            candidates[i] = i;
+    }
+    index.query = query;
+    index.matches.clear();
+    uint64_t query_mask = fts::fuzzy_char_mask(text.data(), text.size());
+    
+    for (uint32_t i: candidates) {
+        Sortable *s = index.sortables[i];
         s->priority = 0;
         s->match_level = 100;
         int out = 0;
-        if (fts::fuzzy_match(text.c_str(), s->name.c_str(), out)) {
-            s->match_level = 0;
-            goto success;
-        }
-        if (!s->generic_name.empty()) {
-            if (fts::fuzzy_match(text.c_str(), s->generic_name.c_str(), out)) {
-                s->match_level = 0;
-                goto success;
+        for (uint32_t f = index.first_field[i]; f < index.first_field[i + 1]; f++) {
+            // The mask and the lowercased text rule out most fields before the real (case sensitive) scoring has to run
+            if ((query_mask & ~index.field_masks[f]) == 0 &&
+                fts::fuzzy_match_lowercase(query.data(), query.size(), index.text.data() + index.field_offsets[f],
+                                           index.field_lengths[f]) &&
+                fts::fuzzy_match(text.c_str(), index.field_strings[f]->c_str(), out)) {
+                s->match_level = index.field_match_levels[f];
+                s->priority = out;
+                index.matches.push_back(i);
+                break;
             }
         }
-        for (auto k: s->keywords) {
-            if (fts::fuzzy_match(text.c_str(), k.c_str(), out))
-                goto success;
-        }
-        for (auto k: s->categories) {
-            if (fts::fuzzy_match(text.c_str(), k.c_str(), out))
-                goto success;
-        }
-        continue;
-        success:
-        s->priority = out;
-        sorted.push_back((*sortables)[i]);
     }
     
-    for (int i = 0; i < sorted.size(); i++) {
-        Sortable *s = (sorted)[i];
-        for (int i = 0; i < history.size(); i++) {
-            HistoricalNameUsed *h = (history)[i];
-            if (h->text == s->lowercase_name) {
-                s->historical_ranking = i;
+    for (uint32_t i: index.matches) {
+        Sortable *s = index.sortables[i];
+        for (int h = 0; h < history.size(); h++) {
+            if (history[h]->text == s->lowercase_name) {
+                s->historical_ranking = h;
             }
         }
     }
-    std::stable_sort(sorted.begin(), sorted.end(),
-                     [](Sortable *a, Sortable *b) {
-                         if (a->match_level == b->match_level) {
-                             if (a->historical_ranking != -1 || b->historical_ranking != -1) {
-                                 if (a->historical_ranking != -1 && b->historical_ranking == -1) {
-                                     return true;
-                                 } else if (a->historical_ranking == -1 && b->historical_ranking != -1) {
-                                     return false;
-                                 } else {
-                                     // TODO: have priority be able to outstrip ranking if its a MUCH better match
-                                     //  'steam' is a problem because 'system settings' beats it
-                                     return a->historical_ranking < b->historical_ranking;
-                                 }
-                             }
-                             
-                             return a->priority > b->priority;
-                         } else {
-                             return a->match_level < b->match_level;
-                         }
-                     });
+    
+    // Only the first few hundred results get a container, so only those have to be in order. Ties go to whoever came
+    // first, the same as a stable sort.
+    std::vector<uint32_t> order = index.matches;
+    auto comes_before = [](Sortable *a, Sortable *b) {
+        if (a->match_level == b->match_level) {
+            if (a->historical_ranking != -1 || b->historical_ranking != -1) {
+                if (a->historical_ranking != -1 && b->historical_ranking == -1) {
+                    return true;
+                } else if (a->historical_ranking == -1 && b->historical_ranking != -1) {
+                    return false;
+                } else {
+                    // TODO: have priority be able to outstrip ranking if its a MUCH better match
+                    //  'steam' is a problem because 'system settings' beats it
+                    return a->historical_ranking < b->historical_ranking;
+                }
+            }
+            
+            return a->priority > b->priority;
+        } else {
+            return a->match_level < b->match_level;
+        }
+    };
+    size_t shown = std::min(order.size(), (size_t) 201);
+    std::partial_sort(order.begin(), order.begin() + shown, order.end(), [&comes_before](uint32_t a, uint32_t b) {
+        Sortable *first = index.sortables[a];
+        Sortable *second = index.sortables[b];
+        if (comes_before(first, second))
+            return true;
+        if (comes_before(second, first))
+            return false;
+        return a < b;
+    });
+    std::vector<T> sorted;
+    sorted.reserve(order.size());
+    for (uint32_t i: order)
+        sorted.push_back((T) index.sortables[i]);
     
     {
 #ifdef TRACY_ENABLE
@@ -1546,6 +1631,7 @@ search_menu_when_closed(AppClient *client) {
 }
 
 void start_search_menu() {
+    search_index_generation++;
     load_scripts();
     Settings settings;
     settings.decorations = false;
@@ -1688,6 +1774,7 @@ void actual_load(bool lock) {
         for (auto sc: temp_scripts) {
             scripts.push_back(sc);
         }
+        search_index_generation++;
         
         update_options();
     } else {
@@ -1700,6 +1787,7 @@ void actual_load(bool lock) {
         for (auto sc: temp_scripts) {
             scripts.push_back(sc);
         }
+        search_index_generation++;
         
         update_options();
     }
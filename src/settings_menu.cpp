@@ -22,6 +22,7 @@
 #include "drawer.h"
 #include "dpi.h"
 #include "icons.h"
+#include "renderer_calibration.h"
 
 #ifdef TRACY_ENABLE
 
@@ -2135,7 +2136,7 @@ fill_icons_root(AppClient *client, Container *icons_root) {
     std::unordered_set<std::string> themes;
     for (auto &target: targets)
         for (auto &cand: target.candidates)
-            themes.insert(cand.theme); // deduplicate
+            themes.insert(std::string(cand.theme())); // deduplicate
     
     struct IconList : UserData {
         std::string text;
@@ -2198,7 +2199,7 @@ fill_icons_root(AppClient *client, Container *icons_root) {
                     std::string path;
                     
                     for (auto &option : target.candidates) {
-                        if (option.theme == theme) {
+                        if (option.theme() == theme) {
                             // todo break at first find
                             path = option.full_path();
                             break;
@@ -2278,7 +2279,7 @@ fill_root(AppClient *client, Container *root) {
     
     setting_subheading_no_indent(scroll_root, "Taskbar");
 
-    setting_bool(scroll_root, "\uE8A1", "Thumbnails", "Show application preview when hovering a window icon", &winbar_settings->thumbnails);
+    setting_bool(scroll_root, "\uE8A1", "Thumbnails", "Show application preview when hovering a window icon. " + thumbnail_memory_report(), &winbar_settings->thumbnails);
     scroll_root->child(FILL_SPACE, 4.5 * config->dpi);
 
     setting_bool(scroll_root, "\uEDA7", "Icon shortcuts", "Lanch or activate programs on Taskbar with Super+$NUMBER", &winbar_settings->pinned_icon_shortcut);
@@ -2353,6 +2354,12 @@ fill_root(AppClient *client, Container *root) {
         app->running = false;
     });
     scroll_root->child(FILL_SPACE, 4.5 * config->dpi);
+    
+    setting_bool(scroll_root, "\uE9D9", "Pick renderer automatically", "Measure cairo and OpenGL on startup and use the faster one. " + renderer_report(), &winbar_settings->auto_renderer, false, []() {
+        restart = true;
+        app->running = false;
+    });
+    scroll_root->child(FILL_SPACE, 4.5 * config->dpi);
 
     setting_bool(scroll_root, "\uEBDE", "Use PipeWire", "Prefer first PipeWire over Pulseaudio and Alsa", &winbar_settings->prefer_pipewire_audio_backend, false, []() {
         restart = true;
@@ -2709,6 +2716,10 @@ void save_settings_file() {
     out_file << "start_menu_height=\"" << std::to_string(winbar_settings->start_menu_height) << "\"";
     out_file << std::endl << std::endl;
 
+    // Thumbnail memory budget
+    out_file << "thumbnail_memory_budget=\"" << std::to_string(winbar_settings->thumbnail_memory_budget) << "\"";
+    out_file << std::endl << std::endl;
+
     // Extra live tile pages
     out_file << "extra_live_tile_pages=\"" << std::to_string(winbar_settings->extra_live_tile_pages) << "\"";
     out_file << std::endl << std::endl;
@@ -2816,6 +2827,9 @@ void save_settings_file() {
     out_file << "use_opengl=" << (winbar_settings->use_opengl ? "true" : "false");
     out_file << std::endl << std::endl;
     
+    out_file << "auto_renderer=" << (winbar_settings->auto_renderer ? "true" : "false");
+    out_file << std::endl << std::endl;
+    
     out_file << "on_drag_show_trash=" << (winbar_settings->on_drag_show_trash ? "true" : "false");
     out_file << std::endl << std::endl;
     
@@ -3073,6 +3087,19 @@ void read_settings_file() {
                             winbar_settings->start_menu_height = height;
                         } catch (...) {
                         
+                        }
+                    }
+                }
+            } else if (key == "thumbnail_memory_budget") {
+                parser.until(LineParser::Token::IDENT);
+                if (parser.current_token == LineParser::Token::IDENT) {
+                    std::string text = parser.until(LineParser::Token::END_OF_LINE);
+                    trim(text);
+                    if (!text.empty()) {
+                        try {
+                            winbar_settings->thumbnail_memory_budget = std::atoi(text.c_str());
+                        } catch (...) {
+                        
                         }
                     }
                 }
@@ -3166,6 +3193,7 @@ void read_settings_file() {
                 parse_bool(&parser, key, "auto_dpi", &winbar_settings->auto_dpi);
                 parse_bool(&parser, key, "prefer_pipewire_audio_backend", &winbar_settings->prefer_pipewire_audio_backend);
                 parse_bool(&parser, key, "use_opengl", &winbar_settings->use_opengl);
+                parse_bool(&parser, key, "auto_renderer", &winbar_settings->auto_renderer);
                 parse_bool(&parser, key, "on_drag_show_trash", &winbar_settings->on_drag_show_trash);
                 parse_string(&parser, key, "custom_desktops_directory", &winbar_settings->custom_desktops_directory);
                 parse_string(&parser, key, "color_mode", &winbar_settings->color_mode);
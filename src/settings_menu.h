@@ -32,6 +32,9 @@ struct WinbarSettings {
     int date_size = 9;
     int start_menu_height = 641;
     int extra_live_tile_pages = 0;
+    // Megabytes full size window captures and their mip chains are allowed to stay around in (0 means only scaled
+    // thumbnails are kept)
+    int thumbnail_memory_budget = 64;
     bool battery_expands_on_hover = true;
     bool battery_label_always_on = false;
     bool volume_expands_on_hover = true;
@@ -53,6 +56,7 @@ struct WinbarSettings {
     bool super_icon_default = true;
     bool label_uniform_size = false;
     bool use_opengl = false;
+    bool auto_renderer = false;
     bool show_windows_from_all_desktops = false;
     bool minimize_maximize_animation = true;
     bool perfect_match = false;
@@ -34,6 +34,10 @@
 #include "plugins_menu.h"
 #include "chatgpt.h"
 #include "settings_menu.h"
+#include "average_color_cache.h"
+#include "shm_surface.h"
+#include "thumbnail_scaler.h"
+#include "icon_loader.h"
 
 #include <algorithm>
 #include <cairo.h>
@@ -45,6 +49,7 @@
 #include <string_view>
 #include <pango/pangocairo.h>
 #include <xcb/xproto.h>
+#include <xcb/xfixes.h>
 #include <dpi.h>
 #include <sys/inotify.h>
 #include "utility.h"
@@ -1394,8 +1399,9 @@ paint_icon_background_win7(AppClient *client, cairo_t *cr, Container *container)
     {
         if (data->window_opened_bloom_scalar != 0 && windows_count >= 1) {
             if (!data->average_color_set) {
-                get_average_color(data->surface__, &data->average_color);
-                data->average_color_set = true;
+                get_average_color_cached(data->surface__, data->surface_path, &data->average_color);
+                // Look again once the icon has actually been decoded
+                data->average_color_set = !icon_load_pending(data->surface__);
             }
             
             double bg_fade = pull(fls, data->window_opened_bloom_scalar);
@@ -1417,8 +1423,8 @@ paint_icon_background_win7(AppClient *client, cairo_t *cr, Container *container)
         cairo_pattern_t* radial = cairo_pattern_create_radial(x, y, 0, x, y, r);
         
         if (!data->average_color_set) {
-            get_average_color(data->surface__, &data->average_color);
-            data->average_color_set = true;
+            get_average_color_cached(data->surface__, data->surface_path, &data->average_color);
+            data->average_color_set = !icon_load_pending(data->surface__);
         }
 
 //        float a = 1;
@@ -4384,8 +4390,11 @@ static int inotify_status_fd = -1;
 static int inotify_capacity_fd = -1;
 static Timeout *pinned_timeout = nullptr;
 
+static void forget_damage_extension(App *app);
+
 static void
 when_taskbar_closed(AppClient *client) {
+    forget_damage_extension(client->app);
     if (inotify_fd != -1) close(inotify_fd);
     inotify_fd = -1;
     inotify_status_fd = -1;
@@ -4492,19 +4501,11 @@ void clear_thumbnails() {
                             cairo_xcb_surface_set_size(windows_data->window_surface,
                                                        windows_data->width, windows_data->height);
                             
-                            cairo_surface_destroy(windows_data->raw_thumbnail_surface);
-                            cairo_destroy(windows_data->raw_thumbnail_cr);
+                            windows_data->release_raw_thumbnail();
+                            windows_data->release_thumbnail_mips();
                             cairo_surface_destroy(windows_data->scaled_thumbnail_surface);
                             cairo_destroy(windows_data->scaled_thumbnail_cr);
                             
-                            windows_data->raw_thumbnail_surface = accelerated_surface(app,
-                                                                                      client_by_name(
-                                                                                              app,
-                                                                                              "taskbar"),
-                                                                                      windows_data->width,
-                                                                                      windows_data->height);
-                            windows_data->raw_thumbnail_cr = cairo_create(
-                                    windows_data->raw_thumbnail_surface);
                             windows_data->scaled_thumbnail_surface = accelerated_surface(app,
                                                                                          client_by_name(
                                                                                                  app,
@@ -4513,6 +4514,8 @@ void clear_thumbnails() {
                                                                                          option_height);
                             windows_data->scaled_thumbnail_cr = cairo_create(
                                     windows_data->scaled_thumbnail_surface);
+                            windows_data->damaged = true;
+                            windows_data->scale_generation++;
                         }
                     }
                 }
@@ -4545,11 +4548,93 @@ std::string uriToFilePath(const std::string& uri) {
     return uri;  // return as-is if no "file://" prefix
 }
 
+// Every WindowsData holding a full size capture (or a mip chain), and how many bytes those take, so that the least
+// recently used ones can be let go when winbar_settings->thumbnail_memory_budget is exceeded
+static std::vector<WindowsData *> raw_thumbnail_owners;
+static size_t raw_thumbnail_bytes = 0;
+static std::vector<WindowsData *> thumbnail_mip_owners;
+static size_t thumbnail_mip_bytes = 0;
+
+static void trim_thumbnail_store(WindowsData *keep);
+
+// Belong to the connection of the App that's running (reset by forget_damage_extension when the taskbar closes, since
+// an in-process restart makes a new connection)
+static bool damage_checked = false;
+static const xcb_query_extension_reply_t *damage_extension = nullptr;
+static xcb_xfixes_region_t damage_region = XCB_NONE;
+
+static bool damage_available(App *app) {
+    if (damage_checked)
+        return damage_region != XCB_NONE;
+    damage_checked = true;
+    
+    damage_extension = xcb_get_extension_data(app->connection, &xcb_damage_id);
+    if (!damage_extension || !damage_extension->present)
+        return false;
+    auto xfixes_extension = xcb_get_extension_data(app->connection, &xcb_xfixes_id);
+    if (!xfixes_extension || !xfixes_extension->present)
+        return false;
+    // Both extensions refuse requests until the client says what version it speaks
+    free(xcb_xfixes_query_version_reply(app->connection, xcb_xfixes_query_version(app->connection, 2, 0), nullptr));
+    auto version = xcb_damage_query_version_reply(app->connection, xcb_damage_query_version(app->connection, 1, 1),
+                                                  nullptr);
+    if (!version)
+        return false;
+    free(version);
+    
+    // Reused for every window since the region is only needed until its rectangles are fetched
+    damage_region = xcb_generate_id(app->connection);
+    xcb_xfixes_create_region(app->connection, damage_region, 0, nullptr);
+    return true;
+}
+
+static void forget_damage_extension(App *app) {
+    if (damage_region != XCB_NONE && app->connection)
+        xcb_xfixes_destroy_region(app->connection, damage_region);
+    damage_region = XCB_NONE;
+    damage_extension = nullptr;
+    damage_checked = false;
+}
+
+// Returns the rectangles of the window that changed since the last call (empty if that couldn't be found out)
+static std::vector<xcb_rectangle_t> take_damage(App *app, xcb_damage_damage_t damage) {
+    std::vector<xcb_rectangle_t> rects;
+    xcb_damage_subtract(app->connection, damage, XCB_NONE, damage_region);
+    auto reply = xcb_xfixes_fetch_region_reply(app->connection, xcb_xfixes_fetch_region(app->connection, damage_region),
+                                               nullptr);
+    if (reply) {
+        auto r = xcb_xfixes_fetch_region_rectangles(reply);
+        rects.assign(r, r + xcb_xfixes_fetch_region_rectangles_length(reply));
+        free(reply);
+    }
+    return rects;
+}
+
 static bool
 window_event_handler(App *app, xcb_generic_event_t *event, xcb_window_t window) {
     for (auto c: app->clients)
         if (c->window == window)
             return false;
+    if (damage_extension && damage_extension->present &&
+        XCB_EVENT_RESPONSE_TYPE(event) == damage_extension->first_event + XCB_DAMAGE_NOTIFY) {
+        auto *e = (xcb_damage_notify_event_t *) event;
+        if (auto client = client_by_name(app, "taskbar")) {
+            if (client->root) {
+                if (auto icons = container_by_name("icons", client->root)) {
+                    for (auto icon: icons->children) {
+                        auto *data = static_cast<LaunchableButton *>(icon->user_data);
+                        for (auto windows_data: data->windows_data_list) {
+                            if (windows_data->damage == e->damage) {
+                                windows_data->damaged = true;
+                                return true;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        return false;
+    }
     // This will listen to configure notify events and check if it's about a
     // window we need a thumbnail of and update its size if so.
     switch (XCB_EVENT_RESPONSE_TYPE(event)) {
@@ -4570,19 +4655,11 @@ window_event_handler(App *app, xcb_generic_event_t *event, xcb_window_t window)
                                         cairo_xcb_surface_set_size(windows_data->window_surface,
                                                                    windows_data->width, windows_data->height);
                                         
-                                        cairo_surface_destroy(windows_data->raw_thumbnail_surface);
-                                        cairo_destroy(windows_data->raw_thumbnail_cr);
+                                        windows_data->release_raw_thumbnail();
+                                        windows_data->release_thumbnail_mips();
                                         cairo_surface_destroy(windows_data->scaled_thumbnail_surface);
                                         cairo_destroy(windows_data->scaled_thumbnail_cr);
                                         
-                                        windows_data->raw_thumbnail_surface = accelerated_surface(app,
-                                                                                                  client_by_name(
-                                                                                                          app,
-                                                                                                          "taskbar"),
-                                                                                                  windows_data->width,
-                                                                                                  windows_data->height);
-                                        windows_data->raw_thumbnail_cr = cairo_create(
-                                                windows_data->raw_thumbnail_surface);
                                         windows_data->scaled_thumbnail_surface = accelerated_surface(app,
                                                                                                      client_by_name(
                                                                                                              app,
@@ -4591,6 +4668,8 @@ window_event_handler(App *app, xcb_generic_event_t *event, xcb_window_t window)
                                                                                                      option_height);
                                         windows_data->scaled_thumbnail_cr = cairo_create(
                                                 windows_data->scaled_thumbnail_surface);
+                                        windows_data->damaged = true;
+                                        windows_data->scale_generation++;
                                     }
                                     return false;
                                 }
@@ -5653,6 +5732,7 @@ void add_window(App *app, xcb_window_t window) {
         path = targets[0].best_full_path;
     }
     
+    data->surface_path = path;
     if (!path.empty()) {
         load_icon_full_path(app, client, &data->surface__, path, icon_width(client));
     } else {
@@ -6187,6 +6267,7 @@ load_pinned_icons() {
         
         if (!path.empty()) {
             load_icon_full_path(app, client_entity, &data->surface__, path, icon_width(client_entity));
+            data->surface_path = path;
         } else {
             data->surface__ = accelerated_surface(app, client_entity, icon_width(client_entity),
                                                   icon_width(client_entity));
@@ -6194,9 +6275,11 @@ load_pinned_icons() {
             std::string home(string);
             home += "/.config/winbar/cached_icons/" + data->class_name + ".png";
             bool b = paint_surface_with_image(data->surface__, home, icon_width(client_entity), nullptr);
+            data->surface_path = home;
             if (!b) {
+                data->surface_path = as_resource_path("unknown-24.svg");
                 paint_surface_with_image(
-                        data->surface__, as_resource_path("unknown-24.svg"), icon_width(client_entity), nullptr);
+                        data->surface__, data->surface_path, icon_width(client_entity), nullptr);
             }
         }
         
@@ -6335,17 +6418,22 @@ void update_pinned_items_icon() {
                     if (path.empty()) {
                         path = targets[1].best_full_path;
                     }
+                    // The icon could be different now so the accent color has to be looked up again
+                    data->average_color_set = false;
                     if (!path.empty()) {
                         load_icon_full_path(app, client, &data->surface__, path, icon_width(client));
+                        data->surface_path = path;
                     } else {
                         data->surface__ = accelerated_surface(app, client, icon_width(client), icon_width(client));
                         char *string = getenv("HOME");
                         std::string home(string);
                         home += "/.config/winbar/cached_icons/" + data->class_name + ".png";
                         bool b = paint_surface_with_image(data->surface__, home, icon_width(client), nullptr);
+                        data->surface_path = home;
                         if (!b) {
+                            data->surface_path = as_resource_path("unknown-24.svg");
                             paint_surface_with_image(
-                                    data->surface__, as_resource_path("unknown-24.svg"), icon_width(client), nullptr);
+                                    data->surface__, data->surface_path, icon_width(client), nullptr);
                         }
                     }
                 }
@@ -6398,9 +6486,11 @@ WindowsData::WindowsData(App *app, xcb_window_t window) {
                                                       (width = geom->width),
                                                       (height = geom->height));
             
-            raw_thumbnail_surface = accelerated_surface(app, client_by_name(app, "taskbar"),
-                                                        width, height);
-            raw_thumbnail_cr = cairo_create(raw_thumbnail_surface);
+            depth = geom->depth;
+            if (damage_available(app)) {
+                damage = xcb_generate_id(app->connection);
+                xcb_damage_create(app->connection, damage, window, XCB_DAMAGE_REPORT_LEVEL_NON_EMPTY);
+            }
             scaled_thumbnail_surface = accelerated_surface(app, client_by_name(app, "taskbar"),
                                                            option_width,
                                                            option_height);
@@ -6413,10 +6503,13 @@ WindowsData::WindowsData(App *app, xcb_window_t window) {
 }
 
 WindowsData::~WindowsData() {
+    // If the window is already gone, the server freed the damage with it and this just produces an ignored error
+    if (damage != XCB_NONE)
+        xcb_damage_destroy(app->connection, damage);
+    release_raw_thumbnail();
+    release_thumbnail_mips();
     if (window_surface) {
         cairo_surface_destroy(window_surface);
-        cairo_surface_destroy(raw_thumbnail_surface);
-        cairo_destroy(raw_thumbnail_cr);
         cairo_surface_destroy(scaled_thumbnail_surface);
         cairo_destroy(scaled_thumbnail_cr);
     }
@@ -6426,46 +6519,280 @@ void WindowsData::take_screenshot() {
 #ifdef TRACY_ENABLE
     ZoneScoped;
 #endif
-    if (!winbar_settings->thumbnails || !mapped || !window_surface || !raw_thumbnail_cr)
+    if (!winbar_settings->thumbnails || !mapped || !window_surface)
         return;
     for (auto c: app->clients)
         if (this->id == c->window)
             if (c->skip_taskbar)
                 return;
+    // The scaling worker is still reading raw_thumbnail_surface (the damage stays around for the next call)
+    if (scale_in_flight)
+        return;
     
-    if (gtk_left_margin == 0 && gtk_right_margin == 0 && gtk_top_margin == 0 && gtk_bottom_margin == 0) {
-        cairo_set_source_surface(raw_thumbnail_cr, window_surface, 0, 0);
-        cairo_paint(raw_thumbnail_cr);
-    } else {
-        cairo_save(raw_thumbnail_cr);
-        cairo_set_source_surface(raw_thumbnail_cr, window_surface, 0, 0);
+    if (damage != XCB_NONE && !damaged)
+        return;
+    bool fresh = raw_thumbnail_surface == nullptr;
+    if (!ensure_raw_thumbnail())
+        return;
+    damaged = false;
+    needs_rescale = true;
+    last_used = get_current_time_in_ms();
+    std::vector<xcb_rectangle_t> rects;
+    if (damage != XCB_NONE)
+        rects = take_damage(app, damage);
+    // A new buffer has nothing in it yet, so all of the window has to be copied
+    if (fresh)
+        rects.clear();
+    
+    // Have the server write the pixels into our shared memory instead of sending them over the socket
+    if (capture_shm(rects)) {
+        if (gtk_left_margin != 0 || gtk_right_margin != 0 || gtk_top_margin != 0 || gtk_bottom_margin != 0) {
+            // Client side decorations put shadows around the window which we don't want in the thumbnail
+            cairo_save(raw_thumbnail_cr);
+            cairo_set_fill_rule(raw_thumbnail_cr, CAIRO_FILL_RULE_EVEN_ODD);
+            cairo_rectangle(raw_thumbnail_cr, 0, 0, width, height);
+            cairo_rectangle(raw_thumbnail_cr, gtk_left_margin, gtk_top_margin,
+                            width - (gtk_right_margin + gtk_left_margin),
+                            height - (gtk_bottom_margin + gtk_top_margin));
+            cairo_set_operator(raw_thumbnail_cr, CAIRO_OPERATOR_CLEAR);
+            cairo_fill(raw_thumbnail_cr);
+            cairo_restore(raw_thumbnail_cr);
+        }
+        return;
+    }
+    
+    cairo_save(raw_thumbnail_cr);
+    cairo_set_source_surface(raw_thumbnail_cr, window_surface, 0, 0);
+    // Replace instead of blending over the last screenshot (matters for translucent windows and partial updates)
+    cairo_set_operator(raw_thumbnail_cr, CAIRO_OPERATOR_SOURCE);
+    if (!rects.empty()) {
+        for (auto r: rects)
+            cairo_rectangle(raw_thumbnail_cr, r.x, r.y, r.width, r.height);
+        cairo_clip(raw_thumbnail_cr);
+    }
+    if (gtk_left_margin != 0 || gtk_right_margin != 0 || gtk_top_margin != 0 || gtk_bottom_margin != 0) {
         cairo_rectangle(raw_thumbnail_cr, gtk_left_margin, gtk_top_margin,
                         width - (gtk_right_margin + gtk_left_margin), height - (gtk_bottom_margin + gtk_top_margin));
         cairo_clip(raw_thumbnail_cr);
-        cairo_paint(raw_thumbnail_cr);
-        cairo_restore(raw_thumbnail_cr);
     }
+    cairo_paint(raw_thumbnail_cr);
+    cairo_restore(raw_thumbnail_cr);
     
     cairo_surface_flush(window_surface);
     cairo_surface_mark_dirty(window_surface);
 }
 
+bool WindowsData::capture_shm(const std::vector<xcb_rectangle_t> &rects) {
+    if (!shm_surface_is_shared(raw_thumbnail_surface))
+        return false;
+    
+    // Only whole rows can be copied into the segment, so damaged rectangles are merged into bands of rows
+    std::vector<std::pair<int, int>> bands;
+    for (auto r: rects)
+        bands.emplace_back(r.y, std::min((int) r.y + r.height, height));
+    std::sort(bands.begin(), bands.end());
+    std::vector<std::pair<int, int>> merged;
+    int total_rows = 0;
+    for (auto band: bands) {
+        if (!merged.empty() && band.first <= merged.back().second) {
+            merged.back().second = std::max(merged.back().second, band.second);
+        } else {
+            merged.push_back(band);
+        }
+    }
+    for (auto band: merged)
+        total_rows += band.second - band.first;
+    
+    // When most of the window changed, one request is cheaper than many
+    if (merged.empty() || total_rows > height * .75)
+        return shm_surface_capture(app, raw_thumbnail_surface, id, depth);
+    for (auto band: merged)
+        if (band.second > band.first)
+            if (!shm_surface_capture(app, raw_thumbnail_surface, id, depth, band.first, band.second - band.first))
+                return false;
+    return true;
+}
+
 void WindowsData::rescale(double scale_w, double scale_h) {
 #ifdef TRACY_ENABLE
     ZoneScoped;
 #endif
-    if (!winbar_settings->thumbnails || !window_surface || !raw_thumbnail_cr)
+    if (!winbar_settings->thumbnails || !window_surface)
         return;
     last_rescale_timestamp = get_current_time_in_ms();
-    
-    cairo_pattern_t *pattern = cairo_pattern_create_for_surface(raw_thumbnail_surface);
-    cairo_pattern_set_filter(pattern, CAIRO_FILTER_GOOD);
-    
-    cairo_save(scaled_thumbnail_cr);
-    cairo_scale(scaled_thumbnail_cr, scale_w, scale_h);
-    cairo_set_source(scaled_thumbnail_cr, pattern);
-    cairo_paint(scaled_thumbnail_cr);
-    cairo_restore(scaled_thumbnail_cr);
+    if (!needs_rescale) {
+        // Nothing new was captured, so the scaled thumbnail would come out the same
+        if (scale_w == last_scale_w && scale_h == last_scale_h)
+            return;
+        // Only the preview size changed, which the mip chain of the last capture can serve right away
+        if (!thumbnail_mips.empty()) {
+            last_used = get_current_time_in_ms();
+            last_scale_w = scale_w;
+            last_scale_h = scale_h;
+            set_scaled_thumbnail(thumbnail_from_mips(thumbnail_mips, scale_w, scale_h, option_width, option_height));
+            return;
+        }
+    }
+    // Asked again once the current one finishes (needs_rescale stays set)
+    if (scale_in_flight)
+        return;
+    // The full size capture was let go to stay under the memory budget, so the window has to be captured again even
+    // if it didn't change
+    if (!raw_thumbnail_surface) {
+        damaged = true;
+        take_screenshot();
+        if (!raw_thumbnail_surface)
+            return;
+    }
+    last_used = get_current_time_in_ms();
+    needs_rescale = false;
+    last_scale_w = scale_w;
+    last_scale_h = scale_h;
+    
+    // Shrinking a 4K window takes long enough to stall the preview, so the mip chain is built on a worker thread
+    scale_in_flight = true;
+    uint64_t generation = ++scale_generation;
+    std::weak_ptr<bool> alive = lifetime;
+    thumbnail_mips_async(app, raw_thumbnail_surface, option_width, option_height,
+                         [this, alive, generation](std::vector<ThumbnailMip> mips) {
+                             if (!alive.lock()) {
+                                 thumbnail_mips_free(mips);
+                                 return;
+                             }
+                             scale_in_flight = false;
+                             if (generation != scale_generation) {
+                                 thumbnail_mips_free(mips);
+                                 return;
+                             }
+                             set_thumbnail_mips(std::move(mips));
+                             set_scaled_thumbnail(thumbnail_from_mips(thumbnail_mips, last_scale_w, last_scale_h,
+                                                                      option_width, option_height));
+                             if (auto c = client_by_name(app, "windows_selector"))
+                                 request_refresh(app, c);
+                             trim_thumbnail_store(nullptr);
+                         });
+}
+
+void WindowsData::set_scaled_thumbnail(cairo_surface_t *surface) {
+    cairo_surface_destroy(scaled_thumbnail_surface);
+    cairo_destroy(scaled_thumbnail_cr);
+    scaled_thumbnail_surface = surface;
+    scaled_thumbnail_cr = cairo_create(scaled_thumbnail_surface);
+}
+
+bool WindowsData::ensure_raw_thumbnail() {
+    if (raw_thumbnail_surface)
+        return true;
+    cairo_surface_t *surface = shm_surface_create(app, width, height);
+    if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+        cairo_surface_destroy(surface);
+        return false;
+    }
+    raw_thumbnail_surface = surface;
+    raw_thumbnail_cr = cairo_create(raw_thumbnail_surface);
+    raw_thumbnail_bytes += (size_t) cairo_image_surface_get_stride(surface) * height;
+    raw_thumbnail_owners.push_back(this);
+    trim_thumbnail_store(this);
+    return true;
+}
+
+void WindowsData::release_raw_thumbnail() {
+    if (!raw_thumbnail_surface)
+        return;
+    raw_thumbnail_bytes -= (size_t) cairo_image_surface_get_stride(raw_thumbnail_surface) *
+                           cairo_image_surface_get_height(raw_thumbnail_surface);
+    raw_thumbnail_owners.erase(std::remove(raw_thumbnail_owners.begin(), raw_thumbnail_owners.end(), this),
+                               raw_thumbnail_owners.end());
+    cairo_destroy(raw_thumbnail_cr);
+    // If the scaling worker still has it, it keeps its own reference until it's done
+    cairo_surface_destroy(raw_thumbnail_surface);
+    raw_thumbnail_cr = nullptr;
+    raw_thumbnail_surface = nullptr;
+    // The scaled thumbnail still shows the window as it is, so nothing is captured again until the window changes
+    // (take_screenshot copies all of it into the new buffer then)
+}
+
+static size_t thumbnail_mips_size(const std::vector<ThumbnailMip> &mips) {
+    size_t bytes = 0;
+    for (const auto &mip: mips)
+        bytes += (size_t) cairo_image_surface_get_stride(mip.surface) * cairo_image_surface_get_height(mip.surface);
+    return bytes;
+}
+
+void WindowsData::set_thumbnail_mips(std::vector<ThumbnailMip> mips) {
+    release_thumbnail_mips();
+    if (mips.empty())
+        return;
+    thumbnail_mips = std::move(mips);
+    thumbnail_mip_bytes += thumbnail_mips_size(thumbnail_mips);
+    thumbnail_mip_owners.push_back(this);
+}
+
+void WindowsData::release_thumbnail_mips() {
+    if (thumbnail_mips.empty())
+        return;
+    thumbnail_mip_bytes -= thumbnail_mips_size(thumbnail_mips);
+    thumbnail_mip_owners.erase(std::remove(thumbnail_mip_owners.begin(), thumbnail_mip_owners.end(), this),
+                               thumbnail_mip_owners.end());
+    thumbnail_mips_free(thumbnail_mips);
+}
+
+static void trim_thumbnail_store(WindowsData *keep) {
+    size_t budget = (size_t) std::max(0, winbar_settings->thumbnail_memory_budget) * 1024 * 1024;
+    if (raw_thumbnail_bytes + thumbnail_mip_bytes <= budget)
+        return;
+    auto by_last_use = [](WindowsData *a, WindowsData *b) {
+        return a->last_used < b->last_used;
+    };
+    std::vector<WindowsData *> least_recently_used = raw_thumbnail_owners;
+    std::sort(least_recently_used.begin(), least_recently_used.end(), by_last_use);
+    for (auto windows_data: least_recently_used) {
+        if (raw_thumbnail_bytes + thumbnail_mip_bytes <= budget)
+            return;
+        if (windows_data == keep || windows_data->scale_in_flight)
+            continue;
+        // A window that isn't on screen can't be captured again, so a capture that wasn't scaled yet is kept
+        if (windows_data->needs_rescale && !windows_data->mapped)
+            continue;
+        windows_data->release_raw_thumbnail();
+    }
+    // Mip chains only save a rescale when the preview size changes, so they go after the full size captures
+    least_recently_used = thumbnail_mip_owners;
+    std::sort(least_recently_used.begin(), least_recently_used.end(), by_last_use);
+    for (auto windows_data: least_recently_used) {
+        if (raw_thumbnail_bytes + thumbnail_mip_bytes <= budget)
+            return;
+        if (windows_data == keep)
+            continue;
+        windows_data->release_thumbnail_mips();
+    }
+}
+
+std::string thumbnail_memory_report() {
+    size_t scaled_bytes = 0;
+    int scaled_count = 0;
+    if (auto client = client_by_name(app, "taskbar")) {
+        if (auto icons = container_by_name("icons", client->root)) {
+            for (auto icon: icons->children) {
+                auto *data = static_cast<LaunchableButton *>(icon->user_data);
+                for (auto windows_data: data->windows_data_list) {
+                    if (auto surface = windows_data->scaled_thumbnail_surface) {
+                        scaled_bytes += (size_t) cairo_image_surface_get_stride(surface) *
+                                        cairo_image_surface_get_height(surface);
+                        scaled_count++;
+                    }
+                    for (const auto &mip: windows_data->thumbnail_mips)
+                        scaled_bytes += (size_t) cairo_image_surface_get_stride(mip.surface) *
+                                        cairo_image_surface_get_height(mip.surface);
+                }
+            }
+        }
+    }
+    char report[256];
+    snprintf(report, sizeof(report), "Using %.1f MB for %d thumbnails and %.1f MB for %d full size captures",
+             scaled_bytes / (1024.0 * 1024.0), scaled_count, raw_thumbnail_bytes / (1024.0 * 1024.0),
+             (int) raw_thumbnail_owners.size());
+    return report;
 }
 
 void taskbar_launch_index(int index) {
@@ -6616,6 +6943,41 @@ gl_surface::gl_surface() {
     //this->client = client_by_name(app, "taskbar");
 }
 
+gl_surface::~gl_surface() {
+    for (auto texture: textures)
+        delete texture;
+}
+
+ClientTexture::~ClientTexture() {
+    // Textures and buffers are shared by every context (through app->share_context), but the vertex array belongs to
+    // the context of the client that made it, so that one has to be current to delete it
+    if (lifetime.lock() && client->gl_window_created && client->should_use_gl) {
+        auto display = glXGetCurrentDisplay();
+        auto context = glXGetCurrentContext();
+        auto draw = glXGetCurrentDrawable();
+        auto read = glXGetCurrentReadDrawable();
+        glXMakeContextCurrent(app->display, client->gl_drawable, client->gl_drawable, client->context);
+        delete texture;
+        // Whoever is painting right now keeps going in their own context
+        if (context) {
+            glXMakeContextCurrent(display, draw, read, context);
+        } else {
+            for (auto *item: app->clients)
+                item->is_context_current = false;
+            client->is_context_current = true;
+        }
+    } else {
+        // The vertex array went away with the client's context, but the texture and buffer still have to be deleted
+        // by some context of the share group (the share context itself if none is current)
+        texture->vao = 0;
+        bool borrowed = !glXGetCurrentContext() && app->share_context &&
+                        glXMakeContextCurrent(app->display, None, None, app->share_context);
+        delete texture;
+        if (borrowed)
+            glXMakeContextCurrent(app->display, None, None, nullptr);
+    }
+}
+
 void on_desktop_change() {
     xcb_get_property_cookie_t cookie =
             xcb_get_property(app->connection,
@@ -5,8 +5,10 @@
 
 #include <utility.h>
 #include <xcb/xcb_aux.h>
+#include <xcb/damage.h>
 #include "application.h"
 #include "drawer.h"
+#include "thumbnail_scaler.h"
 
 class HoverableButton : public UserData {
 public:
@@ -28,6 +30,15 @@ struct ClientTexture {
     ImmediateTexture *texture = new ImmediateTexture;
     AppClient *client = nullptr;
     std::weak_ptr<bool> lifetime;
+    
+    ClientTexture() = default;
+    
+    ClientTexture(const ClientTexture &) = delete;
+    
+    ClientTexture &operator=(const ClientTexture &) = delete;
+    
+    // Frees the texture on the GPU as well
+    ~ClientTexture();
 };
 
 struct gl_surface {
@@ -37,6 +48,12 @@ struct gl_surface {
         
     gl_surface();
     
+    gl_surface(const gl_surface &) = delete;
+    
+    gl_surface &operator=(const gl_surface &) = delete;
+    
+    ~gl_surface();
+    
     AppClient *creation_client = nullptr; // Which client the gl_surface is valid for
 };
 
@@ -101,6 +118,7 @@ public:
     cairo_surface_t *window_surface = nullptr;
     int width = -1;
     int height = -1;
+    int depth = 0;
     
     int gtk_left_margin = 0;
     int gtk_right_margin = 0;
@@ -108,11 +126,31 @@ public:
     int gtk_bottom_margin = 0;
     
     // This is where screenshots are stored every so often (if we could guarantee a compositor, we wouldn't need this.
+    // When possible, it's backed by shared memory so the server can write the window contents straight into it.
+    // It's only allocated when needed and let go once scaled if it doesn't fit in the thumbnail memory budget.
     cairo_surface_t *raw_thumbnail_surface = nullptr;
     cairo_t *raw_thumbnail_cr = nullptr;
     
     long last_rescale_timestamp = 0;
     
+    // Tracks what parts of the window changed so screenshots can skip unchanged windows and only copy what changed
+    xcb_damage_damage_t damage = XCB_NONE;
+    // The window has changed since the last screenshot (always true if XDamage isn't available)
+    bool damaged = true;
+    // raw_thumbnail_surface changed since the last rescale
+    bool needs_rescale = true;
+    double last_scale_w = 0;
+    double last_scale_h = 0;
+    // Scaling happens on a worker thread, results from before the latest request (or resize) are dropped
+    uint64_t scale_generation = 0;
+    bool scale_in_flight = false;
+    // When the full size capture or mip chain was last used (to let go of the least recently used first)
+    long last_used = 0;
+    std::shared_ptr<bool> lifetime = std::make_shared<bool>();
+    
+    // Power of two reductions of the last capture, so a new preview size doesn't need the full capture again
+    std::vector<ThumbnailMip> thumbnail_mips;
+    
     // This is where we rescale the screenshot to the correct thumbnail size
     cairo_surface_t *scaled_thumbnail_surface = nullptr;
     cairo_t *scaled_thumbnail_cr = nullptr;
@@ -130,6 +168,23 @@ public:
     
     void rescale(double scale_w, double scale_h);
     
+    // Copies the damaged rows (or the whole window if rects is empty) straight into raw_thumbnail_surface.
+    // Returns false if the surface isn't shared memory or the server refused, so cairo has to be used instead.
+    bool capture_shm(const std::vector<xcb_rectangle_t> &rects);
+    
+    // Allocates raw_thumbnail_surface (and accounts for it in the thumbnail memory budget) if it doesn't exist.
+    bool ensure_raw_thumbnail();
+    
+    void release_raw_thumbnail();
+    
+    // Replaces thumbnail_mips (taking ownership of mips) and accounts for them in the thumbnail memory budget.
+    void set_thumbnail_mips(std::vector<ThumbnailMip> mips);
+    
+    void release_thumbnail_mips();
+    
+    // Replaces scaled_thumbnail_surface (taking ownership of surface).
+    void set_scaled_thumbnail(cairo_surface_t *surface);
+    
     ~WindowsData();
 };
 
@@ -164,6 +219,8 @@ public:
     double wants_attention_amount = 0;
     bool wants_attention_just_finished = false;
     
+    // The file surface__ was loaded from (empty when it came from the window's _NET_WM_ICON)
+    std::string surface_path;
     bool average_color_set = false;
     ArgbColor average_color;
     
@@ -243,6 +300,9 @@ void update_time(App *app, AppClient *client, Timeout *timeout, void *data);
 
 void clear_thumbnails();
 
+// How much memory window thumbnails and full size captures currently take.
+std::string thumbnail_memory_report();
+
 void label_change(AppClient *taskbar);
 
 void battery_display_device_state_changed();
@@ -18,6 +18,11 @@ struct SleptWindows {
     int width = 0;
     int height = 0;
     // surface texture data
+    
+    ~SleptWindows() {
+        if (surface)
+            cairo_surface_destroy(surface);
+    }
 };
 
 extern std::vector<SleptWindows *> slept;
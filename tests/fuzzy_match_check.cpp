@@ -0,0 +1,122 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+// Checks that the prefilters search_menu.cpp runs before fts::fuzzy_match (fuzzy_char_mask and fuzzy_match_lowercase)
+// never throw away a match, and that fuzzy_match_lowercase answers exactly like fuzzy_match_simple.
+//
+// Built twice by cmake -DCHECKS=ON (run with ctest): once as is, and once with __SSE2__ undefined so the plain loop of
+// fuzzy_match_lowercase gets checked as well. On its own:
+//     g++ -O2 -std=c++17 tests/fuzzy_match_check.cpp -o fuzzy_match_check && ./fuzzy_match_check
+//     g++ -O2 -std=c++17 -U__SSE2__ tests/fuzzy_match_check.cpp -o fuzzy_match_check_scalar && ./fuzzy_match_check_scalar
+
+#define FTS_FUZZY_MATCH_IMPLEMENTATION
+
+#include "../lib/fts_fuzzy_match.h"
+
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool passed, const std::string &what) {
+    if (!passed) {
+        if (failures < 20)
+            printf("FAILED: %s\n", what.c_str());
+        failures++;
+    }
+}
+
+// Lowercased the same way search_index_build and search_menu lowercase the fields and the query
+static std::string lowercase(const std::string &text) {
+    std::string result = text;
+    for (auto &c: result)
+        c = (char) tolower((unsigned char) c);
+    return result;
+}
+
+// Names made out of pieces that look like the ones the search menu sees (mixed case, separators, digits, UTF-8), long
+// enough that fuzzy_match_lowercase goes through several blocks of 16
+static std::vector<std::string> random_names(std::mt19937 &random, int count) {
+    const char *pieces[] = {"gr", "ep", "Ki", "te", "sh", "ar", "Ox", "ul", "vim", "co", "De", "fo", "x", "_", "-", "py",
+                            "3", "zz", "Qt", "na", " ", "\xc3\xa9", "\xff", "Web Browser", "GNOME", "Settings"};
+    const int piece_count = sizeof(pieces) / sizeof(pieces[0]);
+    std::vector<std::string> names;
+    for (int i = 0; i < count; i++) {
+        std::string name;
+        int length = 1 + random() % 14;
+        for (int j = 0; j < length; j++)
+            name += pieces[random() % piece_count];
+        names.push_back(name);
+    }
+    return names;
+}
+
+// A few fixed queries, plus ones picked out of the names (so plenty of them match), some with their case flipped
+static std::vector<std::string> random_queries(std::mt19937 &random, const std::vector<std::string> &names) {
+    std::vector<std::string> queries = {"g", "gr", "gre", "grep", "vim", "ff", "web", "gnome", "x_", "3d", "zz",
+                                        "qt5", "\xc3\xa9", "\xff", "py-", "sh ", "aaaaaa", "settings", "term", "k"};
+    for (int i = 0; i < 300; i++) {
+        const auto &name = names[random() % names.size()];
+        std::string query;
+        for (size_t j = random() % name.size(); j < name.size() && query.size() < 8; j += 1 + random() % 3)
+            query += random() % 3 ? name[j] : (char) toupper((unsigned char) name[j]);
+        queries.push_back(query);
+    }
+    return queries;
+}
+
+int main() {
+    std::mt19937 random(11);
+    const auto names = random_names(random, 5000);
+    const auto queries = random_queries(random, names);
+
+    std::vector<std::string> lowercase_names;
+    std::vector<uint64_t> masks;
+    for (const auto &name: names) {
+        lowercase_names.push_back(lowercase(name));
+        masks.push_back(fts::fuzzy_char_mask(name.data(), name.size()));
+    }
+
+    long pairs = 0;
+    long matches = 0;
+    long past_prefilters = 0;
+    for (const auto &query: queries) {
+        std::string lowercase_query = lowercase(query);
+        uint64_t query_mask = fts::fuzzy_char_mask(query.data(), query.size());
+        for (size_t i = 0; i < names.size(); i++) {
+            const auto &name = names[i];
+            pairs++;
+            int score;
+            bool matched = fts::fuzzy_match(query.c_str(), name.c_str(), score);
+            bool mask_passed = (query_mask & ~masks[i]) == 0;
+            bool lowercase_passed = fts::fuzzy_match_lowercase(lowercase_query.data(), lowercase_query.size(),
+                                                               lowercase_names[i].data(), lowercase_names[i].size());
+
+            check(lowercase_passed == fts::fuzzy_match_simple(query.c_str(), name.c_str()),
+                  "fuzzy_match_lowercase agrees with fuzzy_match_simple for '" + query + "' in '" + name + "'");
+            if (matched) {
+                matches++;
+                check(mask_passed, "fuzzy_char_mask keeps the match of '" + query + "' in '" + name + "'");
+                check(lowercase_passed, "fuzzy_match_lowercase keeps the match of '" + query + "' in '" + name + "'");
+            }
+            past_prefilters += mask_passed && lowercase_passed;
+        }
+    }
+
+#if defined(__SSE2__)
+    const char *implementation = "sse2";
+#else
+    const char *implementation = "scalar";
+#endif
+    printf("%s: %ld pairs, %ld matches, %ld past the prefilters\n", implementation, pairs, matches, past_prefilters);
+
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,219 @@
+//
+// Created by jmanc3 on 10/18/26.
+//
+
+// Checks that every SIMD version of the pixel kernels the CPU supports produces exactly the same result as the
+// scalar one (and that the scalar dye, tint and sum match the per pixel math utility.cpp used before the kernels),
+// then times each version.
+//
+// Built by cmake -DCHECKS=ON (run with ctest), or on its own:
+//     g++ -O2 -std=c++17 tests/pixel_kernels_check.cpp -o pixel_kernels_check && ./pixel_kernels_check
+
+// Included instead of linked so the scalar, SSE2 and AVX2 versions can be called directly
+#include "../lib/pixel_kernels.cpp"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool passed, const char *what) {
+    if (!passed) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+// Random premultiplied pixels (every channel at most the alpha), a fifth of them fully transparent
+static std::vector<uint32_t> random_pixels(int count) {
+    std::mt19937 random(1);
+    std::vector<uint32_t> pixels(count);
+    for (auto &pixel: pixels) {
+        uint32_t a = random() % 5 == 0 ? 0 : random() % 256;
+        auto channel = [&random, a]() -> uint32_t { return random() % (a + 1); };
+        uint32_t r = channel();
+        uint32_t g = channel();
+        uint32_t b = channel();
+        pixel = (a << 24) | (r << 16) | (g << 8) | b;
+    }
+    return pixels;
+}
+
+// What dye_surface did to every pixel before the kernels
+static uint32_t dye_reference(uint32_t color, uint32_t red, uint32_t green, uint32_t blue) {
+    uint32_t alpha = color >> 24;
+    return (alpha << 24) | ((red * alpha / 255) << 16) | (green * alpha / 255 << 8) | blue * alpha / 255;
+}
+
+// What tint_surface did to every pixel before the kernels
+static uint32_t tint_reference(uint32_t color, uint32_t tint_r, uint32_t tint_g, uint32_t tint_b) {
+    uint32_t r = (color >> 16) & 0xFF;
+    uint32_t g = (color >> 8) & 0xFF;
+    uint32_t b = color & 0xFF;
+    return (color & 0xff000000) | ((r * tint_r / 255) << 16) | ((g * tint_g / 255) << 8) | (b * tint_b / 255);
+}
+
+static bool same_sums(const PixelSums &a, const PixelSums &b) {
+    return a.a == b.a && a.r == b.r && a.g == b.g && a.b == b.b && a.visible == b.visible;
+}
+
+static bool still_premultiplied(const std::vector<uint32_t> &pixels) {
+    for (auto pixel: pixels) {
+        uint32_t a = pixel >> 24;
+        if (((pixel >> 16) & 0xff) > a || ((pixel >> 8) & 0xff) > a || (pixel & 0xff) > a)
+            return false;
+    }
+    return true;
+}
+
+struct Implementation {
+    const char *name;
+    void (*dye)(uint32_t *, int, uint8_t, uint8_t, uint8_t);
+    void (*tint)(uint32_t *, int, uint8_t, uint8_t, uint8_t);
+    void (*opacity)(uint32_t *, int, int, int);
+    void (*sum)(const uint32_t *, int, PixelSums *);
+    void (*accumulate)(const uint32_t *, int, uint32_t *);
+};
+
+static std::vector<Implementation> supported_implementations() {
+    std::vector<Implementation> implementations;
+    implementations.push_back({"scalar", dye_scalar, tint_scalar, opacity_scalar, sum_scalar, accumulate_scalar});
+#ifdef PIXEL_KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        implementations.push_back({"sse2", dye_sse2, tint_sse2, opacity_sse2, sum_sse2, accumulate_sse2});
+    if (__builtin_cpu_supports("avx2"))
+        implementations.push_back({"avx2", dye_avx2, tint_avx2, opacity_avx2, sum_avx2, accumulate_avx2});
+#endif
+    return implementations;
+}
+
+template<typename Kernel>
+static double time_ms(const std::vector<uint32_t> &pixels, Kernel kernel) {
+    const int runs = 50;
+    auto copy = pixels;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < runs; i++)
+        kernel(copy.data(), (int) copy.size());
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / runs;
+}
+
+int main() {
+    // Odd so every version also goes through its tail
+    const int count = 1000003;
+    const auto pixels = random_pixels(count);
+    const auto implementations = supported_implementations();
+    const auto &scalar = implementations[0];
+
+    // The scalar versions against the math they replaced
+    {
+        auto dyed = pixels;
+        scalar.dye(dyed.data(), count, 200, 13, 255);
+        bool same = true;
+        for (int i = 0; i < count; i++)
+            same = same && dyed[i] == dye_reference(pixels[i], 200, 13, 255);
+        check(same, "scalar dye matches the old dye_surface");
+
+        auto tinted = pixels;
+        scalar.tint(tinted.data(), count, 120, 255, 0);
+        same = true;
+        for (int i = 0; i < count; i++)
+            same = same && tinted[i] == tint_reference(pixels[i], 120, 255, 0);
+        check(same, "scalar tint matches the old tint_surface");
+
+        PixelSums sums;
+        scalar.sum(pixels.data(), count, &sums);
+        PixelSums expected;
+        for (auto pixel: pixels) {
+            expected.a += pixel >> 24;
+            expected.r += (pixel >> 16) & 0xff;
+            expected.g += (pixel >> 8) & 0xff;
+            expected.b += pixel & 0xff;
+            expected.visible += (pixel >> 24) != 0;
+        }
+        check(same_sums(sums, expected), "scalar sum matches summing every pixel");
+    }
+
+    // Every SIMD version against the scalar one
+    for (const auto &implementation: implementations) {
+        if (&implementation == &scalar)
+            continue;
+        char what[128];
+
+        auto expected = pixels;
+        auto result = pixels;
+        scalar.dye(expected.data(), count, 200, 13, 255);
+        implementation.dye(result.data(), count, 200, 13, 255);
+        snprintf(what, sizeof(what), "%s dye matches scalar", implementation.name);
+        check(result == expected, what);
+
+        expected = pixels;
+        result = pixels;
+        scalar.tint(expected.data(), count, 120, 255, 0);
+        implementation.tint(result.data(), count, 120, 255, 0);
+        snprintf(what, sizeof(what), "%s tint matches scalar", implementation.name);
+        check(result == expected, what);
+
+        for (int delta: {-300, -40, 0, 60, 300}) {
+            for (int threshold: {-1, 0, 100}) {
+                expected = pixels;
+                result = pixels;
+                scalar.opacity(expected.data(), count, delta, threshold);
+                implementation.opacity(result.data(), count, delta, threshold);
+                snprintf(what, sizeof(what), "%s opacity (delta %d, threshold %d) matches scalar",
+                         implementation.name, delta, threshold);
+                check(result == expected, what);
+            }
+        }
+
+        PixelSums expected_sums;
+        PixelSums sums;
+        scalar.sum(pixels.data(), count, &expected_sums);
+        implementation.sum(pixels.data(), count, &sums);
+        snprintf(what, sizeof(what), "%s sum matches scalar", implementation.name);
+        check(same_sums(sums, expected_sums), what);
+
+        std::vector<uint32_t> expected_accumulated(count * 4, 0);
+        std::vector<uint32_t> accumulated(count * 4, 0);
+        for (int i = 0; i < 3; i++) {
+            scalar.accumulate(pixels.data(), count, expected_accumulated.data());
+            implementation.accumulate(pixels.data(), count, accumulated.data());
+        }
+        snprintf(what, sizeof(what), "%s accumulate matches scalar", implementation.name);
+        check(accumulated == expected_accumulated, what);
+    }
+
+    // Opacity rescales the premultiplied color (instead of multiplying it by the alpha a second time like the old
+    // dye_opacity did), so it has no old version to compare against, but the result has to stay premultiplied
+    for (int delta: {-300, -40, 60, 300}) {
+        auto result = pixels;
+        scalar.opacity(result.data(), count, delta, 0);
+        check(still_premultiplied(result), "opacity keeps pixels premultiplied");
+    }
+
+    printf("%d pixels, picked implementation: %s\n", count, pixel_kernels_implementation());
+    for (const auto &implementation: implementations) {
+        auto dye = implementation.dye;
+        auto tint = implementation.tint;
+        auto opacity = implementation.opacity;
+        auto sum = implementation.sum;
+        printf("%-6s dye %.2fms, tint %.2fms, opacity %.2fms, sum %.2fms\n", implementation.name,
+               time_ms(pixels, [dye](uint32_t *row, int n) { dye(row, n, 200, 13, 255); }),
+               time_ms(pixels, [tint](uint32_t *row, int n) { tint(row, n, 120, 255, 0); }),
+               time_ms(pixels, [opacity](uint32_t *row, int n) { opacity(row, n, 60, 0); }),
+               time_ms(pixels, [sum](uint32_t *row, int n) {
+                   PixelSums sums;
+                   sum(row, n, &sums);
+               }));
+    }
+
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}